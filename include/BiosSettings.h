@@ -9,6 +9,7 @@
 #define CLOCK_MODE_ADDR 13       // Internal EEPROM address for the Z80 clock high/low speed switch.
 #define DISK_SET_ADDR 14         // Internal EEPROM address for the current disk set [0..99].
 #define STARTUP_JINGLE_ADDR 15   // Internal EEPROM address of startup jingle flag storage.
+#define BAUD_RATE_ADDR 16        // Internal EEPROM address of the console BAUD rate.
 #define MAX_DISK_NUM 99          // Maximum number of virtual disks.
 #define MAX_DISK_SET 6           // Maximum number of configured disk sets.
 
@@ -17,12 +18,62 @@ enum class ClockMode : uint8_t {
 	FAST = 0
 };
 
+/**
+ * @brief Console BAUD rates. Only rates the double speed UART divisors hit
+ * within 2.1% are offered (250k, 500k and 1M are exact from 16MHz).
+ */
+enum class BaudRate : uint8_t {
+	B9600 = 0,
+	B19200 = 1,
+	B38400 = 2,
+	B57600 = 3,
+	B115200 = 4,
+	B250000 = 5,
+	B500000 = 6,
+	B1000000 = 7
+};
+
+#if F_CPU == 20000000
+	#define MAX_BAUD_RATE BaudRate::B500000    // 1M is not reachable from 20MHz.
+#else
+	#define MAX_BAUD_RATE BaudRate::B1000000
+#endif
+
+/**
+ * @brief Gets the bits per second of a BAUD rate setting.
+ *
+ * @param rate The BAUD rate setting.
+ * @return unsigned long The BAUD rate.
+ */
+inline unsigned long baudRateValue(BaudRate rate) {
+	switch (rate) {
+		case BaudRate::B9600:
+			return 9600;
+		case BaudRate::B19200:
+			return 19200;
+		case BaudRate::B38400:
+			return 38400;
+		case BaudRate::B57600:
+			return 57600;
+		case BaudRate::B250000:
+			return 250000;
+		case BaudRate::B500000:
+			return 500000;
+		case BaudRate::B1000000:
+			return 1000000;
+		case BaudRate::B115200:
+		default:
+			return 115200;
+	}
+}
+
 enum class BootMode : uint8_t {
 	BASIC = 0,
 	FORTH = 1,
 	OS_ON_SD = 2,
 	AUTO = 3,
-	ILOAD = 4
+	ILOAD = 4,
+	RESUME = 5
 };
 
 struct BiosSettings {
@@ -31,6 +82,7 @@ struct BiosSettings {
 	bool autoExecFlag;
 	bool enableStartupJingle;
 	BootMode bootMode;
+	BaudRate baudRate;
 
 	BiosSettings() {
 		clockMode = ClockMode::SLOW;
@@ -38,6 +90,23 @@ struct BiosSettings {
 		autoExecFlag = false;
 		enableStartupJingle = true;
 		bootMode = BootMode::ILOAD;
+		baudRate = BaudRate::B115200;
+	}
+
+	/**
+	 * @brief Reads the console BAUD rate alone, so the console can be set up
+	 * before the rest of the settings are loaded. An unset or unsupported
+	 * value reads as 115200.
+	 *
+	 * @return BaudRate The stored BAUD rate.
+	 */
+	static BaudRate readBaudRate() {
+		byte rate = EEPROM.read(BAUD_RATE_ADDR);
+		if (rate > (byte)MAX_BAUD_RATE) {
+			return BaudRate::B115200;
+		}
+
+		return (BaudRate)rate;
 	}
 
 	void load() {
@@ -61,6 +130,7 @@ struct BiosSettings {
 		autoExecFlag = (bool)EEPROM.read(AUTOEXEC_FLAG_ADDR);
 		bootMode = (BootMode)EEPROM.read(BOOT_MODE_ADDR);
 		enableStartupJingle = (bool)EEPROM.read(STARTUP_JINGLE_ADDR);
+		baudRate = readBaudRate();
 	}
 
 	void save() {
@@ -69,6 +139,7 @@ struct BiosSettings {
 		EEPROM.update(AUTOEXEC_FLAG_ADDR, (byte)autoExecFlag);
 		EEPROM.update(BOOT_MODE_ADDR, (byte)bootMode);
 		EEPROM.update(STARTUP_JINGLE_ADDR, (byte)enableStartupJingle);
+		EEPROM.update(BAUD_RATE_ADDR, (byte)baudRate);
 	}
 };
 
@@ -0,0 +1,61 @@
+#ifndef _BOOT_MANIFEST_H
+#define _BOOT_MANIFEST_H
+
+#include <Arduino.h>
+
+#define BOOT_MANIFEST_MAX_SEGMENTS 8    // Maximum number of files in a manifest.
+#define BOOT_MANIFEST_ENTRY "ENTRY"     // Keyword of the entry point line.
+
+/**
+ * @brief A boot image segment: a file loaded at an address of an OS bank.
+ */
+struct BootSegment {
+    char fileName[13];
+    byte osBank;
+    word addr;
+};
+
+/**
+ * @brief Loads banked operating systems described by a boot manifest.
+ * 
+ * A boot manifest is a text file on SD. Every line holds a file name, the OS
+ * bank [0..2] (see OP_IO_WR_SETBNK) and the hex load address, separated by
+ * blanks. Addresses from 0x8000 up land in the common fixed bank whatever
+ * the OS bank is. The "ENTRY" line gives the OS bank to leave selected and
+ * the address the Z80 starts from (it defaults to the first segment). Text
+ * after '#' or ';' is a comment. Example:
+ * 
+ *   # CP/M 3 banked
+ *   BNKBDOS3.BIN  1  0000
+ *   RESBDOS3.BIN  0  E800
+ *   BIOS3.BIN     0  F600
+ *   ENTRY         0  F600
+ */
+class BootManifestClass {
+public:
+    BootManifestClass();
+
+    /**
+     * @brief Parses the manifest and injects every segment into its bank.
+     * The entry bank is left selected. Nothing is injected if the manifest
+     * is invalid.
+     * 
+     * @param manifestName The manifest file name.
+     * @return byte ERR_DSK_EMU_OK or a Disk Emulation Error Code.
+     */
+    byte load(const char* manifestName);
+    byte entryBank();
+    word entryAddr();
+    const char* lastFileName();
+
+private:
+    byte parse(const char* manifestName, BootSegment* segments);
+    byte loadSegment(const BootSegment* segment);
+    byte _numSegments;
+    byte _entryBank;
+    word _entryAddr;
+    char _lastFileName[13];
+};
+
+extern BootManifestClass BootManifest;
+#endif
@@ -0,0 +1,112 @@
+#ifndef _BOOT_PROFILER_H
+#define _BOOT_PROFILER_H
+
+#include <Arduino.h>
+#include "hal.h"
+
+#define BOOT_REPORT_ADDR 64          // Internal EEPROM address of the boot record ring.
+#define BOOT_REPORT_RECORDS 4        // Number of boot records kept in the ring.
+#define BOOT_REPORT_NO_SEQ 0xFFFF    // Sequence number of an erased (unused) slot.
+
+/**
+ * @brief The boot steps timed by the profiler. Stages include their sub-steps,
+ * so sub-step times are not additive with their stage.
+ */
+enum class BootStep : uint8_t {
+	STAGE0 = 0,
+	RUN_TRIGGER = 1,    // Rest of the 200ms settle delay + wait for RUN (stage 0).
+	STAGE1 = 2,
+	STAGE2 = 3,
+	STAGE3 = 4,         // Runs inside stage 0, before RUN (with the SD prefetch).
+	I2C_PROBE = 5,      // RTC, bus controller, cards and SPP detection (stage 3).
+	STAGE4 = 6,
+	BOOT_MENU = 7,      // Time spent in the boot menu (user input, stage 4).
+	SD_MOUNT = 8,       // All mountSD() calls during boot.
+	IMAGE_LOAD = 9,     // Boot image, manifest or snapshot load (stage 4).
+	STAGE5 = 10,
+	JINGLE = 11         // Wait for the background startup jingle to end (stage 5).
+};
+
+#define BOOT_STEP_COUNT 12
+
+/**
+ * @brief A boot record, as stored in EEPROM and returned by OP_IO_RD_BOOTREP.
+ * All times are in microseconds (LSB first).
+ */
+struct BootRecord {
+	word seq;                                 // Boot sequence number.
+	uint32_t totalUs;                         // Reset to end of boot stage 5.
+	uint32_t stepUs[BOOT_STEP_COUNT];         // Accumulated time per BootStep.
+};
+
+#ifdef BOOT_PROFILER
+	#define PROFILE_BEGIN(step) BootProfiler.begin(step)
+	#define PROFILE_END(step) BootProfiler.end(step)
+#else
+	#define PROFILE_BEGIN(step)
+	#define PROFILE_END(step)
+#endif
+
+class BootProfilerClass {
+public:
+    BootProfilerClass();
+
+    /**
+     * @brief Starts timing a boot step. A step can be started and ended any
+     * number of times; the times are accumulated. Ignored once finish() was
+     * called, so steps that also run after boot (SD_MOUNT) don't change the
+     * closed record.
+     *
+     * @param step The boot step.
+     */
+    void begin(BootStep step);
+
+    /**
+     * @brief Stops timing a boot step.
+     *
+     * @param step The boot step.
+     */
+    void end(BootStep step);
+
+    /**
+     * @brief Closes the boot record (later begin()/end() calls are ignored), prints the summary table (DEBUG only)
+     * and queues the record to be stored in the EEPROM ring by service().
+     */
+    void finish();
+
+    /**
+     * @brief Writes the pending boot record to EEPROM, one byte per call and
+     * only when the EEPROM is ready, so it never stalls the I/O loop.
+     */
+    void service();
+
+    /**
+     * @brief Gets the size of the boot report returned by OP_IO_RD_BOOTREP.
+     *
+     * @return byte The report size in bytes.
+     */
+    byte reportSize();
+
+    /**
+     * @brief Gets a byte of the boot report: the record count, the record
+     * size, then the boot records, newest first.
+     *
+     * @param index The byte index [0..reportSize() - 1].
+     * @return byte The report byte.
+     */
+    byte reportByte(byte index);
+
+private:
+    void findNewestSlot();
+    void printStepName(byte step);
+    int slotAddress(byte slot);
+
+    BootRecord record;
+    byte calls[BOOT_STEP_COUNT];
+    byte writeSlot;
+    byte pendingOffset;
+    bool finished;
+};
+
+extern BootProfilerClass BootProfiler;
+#endif
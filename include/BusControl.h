@@ -2,7 +2,7 @@
 #define _BUSCTRL
 
 #include <Arduino.h>
-#include "Adafruit_MCP23X17.h"
+#include "Mcp23017.h"
 
 class BusControlClass {
 public:
@@ -18,19 +18,132 @@ public:
     void writeGPPUB(byte data);
     byte readGPIOA();
     byte readGPIOB();
+
+    /**
+     * @brief Writes GPIOA (LSB) and GPIOB (MSB) in one transaction. Like the
+     * other expander writes, does nothing if the value didn't change.
+     *
+     * @param data The GPIOB:GPIOA value.
+     */
+    void writeGPIOAB(word data);
+
+    /**
+     * @brief Sets the input pins sampled in the background. While any pin is
+     * watched, GPIO reads are served from the last sample (with the output
+     * pins taken from the latch shadow) instead of an I2C read.
+     *
+     * @param mask The GPIOB:GPIOA pins to watch (0 stops sampling).
+     */
+    void setInputWatch(word mask);
+
+    word inputWatch();
+
+    /**
+     * @brief Reads both ports when GPIO_SAMPLE_US have passed since the last
+     * sample. Called from the I/O loop background tasks.
+     *
+     * @return true if a watched pin changed since the previous sample.
+     */
+    bool sampleInputs();
+
+    /**
+     * @brief Sets output latch bits of a port (read-modify-write on the
+     * shadow, so only the write goes over I2C).
+     *
+     * @param port GPIO_PORT_A or GPIO_PORT_B.
+     * @param mask The bits to set.
+     */
+    void setGPIOBits(byte port, byte mask);
+
+    /**
+     * @brief Clears output latch bits of a port.
+     *
+     * @param port GPIO_PORT_A or GPIO_PORT_B.
+     * @param mask The bits to clear.
+     */
+    void clearGPIOBits(byte port, byte mask);
+
+    /**
+     * @brief Toggles output latch bits of a port.
+     *
+     * @param port GPIO_PORT_A or GPIO_PORT_B.
+     * @param mask The bits to toggle.
+     */
+    void toggleGPIOBits(byte port, byte mask);
+
+    /**
+     * @brief Reads GPIOA (LSB) and GPIOB (MSB) in one transaction.
+     *
+     * @return word The GPIOB:GPIOA value (0 if there is no expander).
+     */
+    word readGPIOAB();
     void detectCards();
+    void restoreCards(bool card1, bool card2, bool card3);
+
+    /**
+     * @brief Reads the CPRES lines when CARD_POLL_MS have passed since the
+     * last poll. A change seen on two polls in a row is applied: the card
+     * flags are updated and the CEN lines follow them (present = enabled).
+     * Called from the I/O loop background tasks.
+     *
+     * @return true if the slot mask changed.
+     */
+    bool pollCards();
+
+    /**
+     * @brief Gets the slots with a card.
+     *
+     * @return byte Bit 0 = slot 1, bit 1 = slot 2, bit 2 = slot 3.
+     */
+    byte slotMask();
+
+    /**
+     * @brief Finds the slot of the card answering at an I2C address, by
+     * disabling the present slots one at a time (CEN) until the address
+     * stops answering. Only called at boot, while the Z80 is held: it
+     * briefly disables live cards.
+     *
+     * NOTE: Assumes a disabled card (CEN inactive) is cut off the I2C bus as
+     * well as the Z80 bus. A card that still answers with CEN inactive is
+     * never found (IO_SLOT_NONE), unless it is the only one.
+     *
+     * @param addr The 7 bit address of a device on the card.
+     * @return byte The slot index (0 = slot 1), or IO_SLOT_NONE if the
+     * address doesn't answer or no single slot owns it.
+     */
+    byte findCardSlot(byte addr);
+
+    /**
+     * @brief Gets the slot of the only card present (no I2C).
+     *
+     * @return byte The slot index (0 = slot 1), or IO_SLOT_NONE unless
+     * exactly one card is present.
+     */
+    byte onlyCardSlot();
     bool card1Present();
     bool card2Present();
     bool card3Present();
     bool noCardsPresent() { return !_card1Present && !_card2Present && !_card3Present; }
 
 private:
-    bool _hasIOXEP;
-    bool _hasBUSCTRL;
+    void writeCardEnables();
+    bool readSlots(byte* slots);
+    void applySlots(byte slots);
+    void writeEnables(byte slots);
+    word sampledGPIO();
+
+    Mcp23017 _ioExp;        // GPIO expander.
+    Mcp23017 _busCtlr;      // Bus controller (CPRES and CEN lines on GPIOA).
     bool _card1Present;
     bool _card2Present;
     bool _card3Present;
-    Adafruit_MCP23X17 _busctlr;
+    byte _pendingSlots;             // Last slot mask read (see pollCards()).
+    unsigned long _cardPollTime;
+
+    // Background input sampling.
+    word _watchMask;
+    word _inputs;
+    unsigned long _sampleTime;
 };
 
 
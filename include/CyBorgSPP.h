@@ -2,20 +2,60 @@
 #define _CYBORG_SPP_H
 
 #include <Arduino.h>
+#include "hal.h"
+#include "Mcp23017.h"
+
+#if (SPP_SPOOL_SIZE & (SPP_SPOOL_SIZE - 1)) || (SPP_SPOOL_SIZE > 256)
+    #error "SPP_SPOOL_SIZE must be a power of 2, up to 256"
+#endif
 
 class CyBorgSPPClass {
 public:
     CyBorgSPPClass();
     void detect();
     bool isPresent();
+
+    /**
+     * @brief Initializes the SPP port and the printer. Drops what is left
+     * in the spool.
+     *
+     * @param data D0 = AUTOFD, D1 = report the spool status (see
+     * OP_SPP_WR_INIT).
+     */
     void init(byte data);
+
+    /**
+     * @brief Appends a byte to the print spool. Only waits (printing) if the
+     * spool is full.
+     *
+     * @param data The byte to print.
+     */
     void write(byte data);
+
+    /**
+     * @brief Reads the SPP status lines and the spool status (see
+     * OP_SPP_RD_READ).
+     *
+     * @return byte The status.
+     */
     byte read();
 
+    /**
+     * @brief Sends the next spooled byte once the printer is ready (BUSY low,
+     * ACK high). Called from the I/O loop background tasks.
+     */
+    void service();
+
 private:
-    bool _isPresent;
+    void sendByte(byte data);
+
+    Mcp23017 _port;
     byte _sppAutoFd;
+    bool _spoolStatus;      // Report the spool status in read() (D1/D2).
     byte _tempData;
+    byte _spool[SPP_SPOOL_SIZE];
+    byte _spoolHead;
+    byte _spoolTail;
 };
 
 extern CyBorgSPPClass CyBorgSPP;
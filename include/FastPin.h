@@ -0,0 +1,73 @@
+#ifndef _FAST_PIN_H
+#define _FAST_PIN_H
+
+#include <Arduino.h>
+
+/**
+ * @brief Compile time access to an ATmega32 pin, keyed on the PIN_* numbers
+ * in hal.h (MightyCore standard pinout: D0-D7 = PB, D8-D15 = PD, D16-D23 =
+ * PC, D24-D31 = PA). The port and bit are resolved at compile time, so each
+ * access compiles to a single sbi/cbi (write) or sbis/sbic/in (read)
+ * instead of a digitalWrite()/digitalRead() call with its pin map lookups
+ * and SREG save/restore. Use it on the bus critical paths only; the rest of
+ * the code keeps the Arduino calls.
+ *
+ * NOTE: Like sbi/cbi, high() and low() are atomic. toggle() is not.
+ */
+template <uint8_t Pin>
+class FastPin {
+public:
+    static_assert(Pin < 32, "FastPin: not an ATmega32 pin");
+
+    static inline void high() __attribute__((always_inline)) {
+        port() |= mask();
+    }
+
+    static inline void low() __attribute__((always_inline)) {
+        port() &= ~mask();
+    }
+
+    static inline void write(bool value) __attribute__((always_inline)) {
+        if (value) {
+            high();
+        }
+        else {
+            low();
+        }
+    }
+
+    static inline void toggle() __attribute__((always_inline)) {
+        port() ^= mask();
+    }
+
+    static inline bool read() __attribute__((always_inline)) {
+        return (pin() & mask()) != 0;
+    }
+
+    static inline void output() __attribute__((always_inline)) {
+        ddr() |= mask();
+    }
+
+    static inline void input() __attribute__((always_inline)) {
+        ddr() &= ~mask();
+    }
+
+    static constexpr uint8_t mask() {
+        return (uint8_t)(1 << (Pin & 7));
+    }
+
+private:
+    static inline volatile uint8_t& port() __attribute__((always_inline)) {
+        return (Pin < 8) ? PORTB : (Pin < 16) ? PORTD : (Pin < 24) ? PORTC : PORTA;
+    }
+
+    static inline volatile uint8_t& pin() __attribute__((always_inline)) {
+        return (Pin < 8) ? PINB : (Pin < 16) ? PIND : (Pin < 24) ? PINC : PINA;
+    }
+
+    static inline volatile uint8_t& ddr() __attribute__((always_inline)) {
+        return (Pin < 8) ? DDRB : (Pin < 16) ? DDRD : (Pin < 24) ? DDRC : DDRA;
+    }
+};
+
+#endif
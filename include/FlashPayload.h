@@ -0,0 +1,43 @@
+#ifndef _FLASH_PAYLOAD_H
+#define _FLASH_PAYLOAD_H
+
+#include <Arduino.h>
+
+#define LZ_WINDOW_SIZE 64    // History kept by the decoder (see tools/lzpack.py). Power of 2, up to 256.
+#define LZ_MIN_MATCH 3
+
+/**
+ * @brief A resident boot image stored LZ compressed in flash.
+ */
+struct ResidentPayload {
+    byte bootMode;        // The BootMode this payload boots.
+    word strAddr;         // Load (and start) address in Z80 RAM.
+    word rawSize;         // Uncompressed image size.
+    word rawCrc;          // CRC-16/XMODEM of the uncompressed image (see tools/lzpack.py).
+    const byte* data;     // LZ compressed image (PROGMEM).
+};
+
+class FlashPayloadClass {
+public:
+    FlashPayloadClass();
+
+    /**
+     * @brief Looks up the resident payload for a boot mode in flashBootTable.
+     * 
+     * @param bootMode The boot mode.
+     * @param payload Receives a copy of the table entry.
+     * @return true if a resident payload exists for the boot mode.
+     */
+    bool find(byte bootMode, ResidentPayload* payload);
+
+    /**
+     * @brief Decompresses the payload on the fly into Z80 RAM at the address
+     * currently in HL (see loadHL()).
+     * 
+     * @param payload The payload to inject.
+     */
+    void inject(const ResidentPayload* payload);
+};
+
+extern FlashPayloadClass FlashPayload;
+#endif
@@ -0,0 +1,102 @@
+#ifndef _HW_PROFILE_H
+#define _HW_PROFILE_H
+
+#include <Arduino.h>
+#include <EEPROM.h>
+#include "PetitFS.h"
+
+#define HW_PROFILE_ADDR 288      // Internal EEPROM address of the hardware profile (after the boot report ring).
+#define HW_PROFILE_VERSION 1
+
+// Detected device flags.
+#define HW_DEV_RTC 0x01
+#define HW_DEV_IOEXP 0x02
+#define HW_DEV_BUSCTLR 0x04
+#define HW_DEV_CARD1 0x08
+#define HW_DEV_CARD2 0x10
+#define HW_DEV_CARD3 0x20
+#define HW_DEV_SPP 0x40
+#define HW_DEV_SD 0x80
+
+/**
+ * @brief What was found on the last boot: the I2C devices, the SD card type
+ * and FAT geometry, and where the boot file starts. A warm boot (MCU reset
+ * without a power cycle) that finds a valid profile validates it with a
+ * few cheap checks instead of probing everything again.
+ */
+struct HwProfile {
+	byte version;
+	byte devices;
+	byte cardType;           // Card type from disk_initialize().
+	FATFS fatfs;             // FAT geometry from pf_mount() (no open file).
+	DWORD volid;             // Volume serial number, to detect a card swap.
+	char bootFile[13];       // Boot file the location below belongs to.
+	DWORD bootClust;
+	DWORD bootSize;
+	byte checksum;
+
+	HwProfile() {
+		memset(this, 0, sizeof(HwProfile));
+	}
+
+	/**
+	 * @brief Loads the profile from EEPROM.
+	 *
+	 * @return true if the stored profile is valid.
+	 */
+	bool load() {
+		EEPROM.get(HW_PROFILE_ADDR, *this);
+		return (version == HW_PROFILE_VERSION) && (checksum == calcChecksum());
+	}
+
+	/**
+	 * @brief Stores the profile in EEPROM. Only changed bytes are written.
+	 */
+	void save() {
+		version = HW_PROFILE_VERSION;
+		checksum = calcChecksum();
+		EEPROM.put(HW_PROFILE_ADDR, *this);
+	}
+
+	bool hasDevice(byte device) {
+		return (devices & device) == device;
+	}
+
+	void setDevice(byte device, bool present) {
+		devices = present ? (devices | device) : (devices & ~device);
+	}
+
+	/**
+	 * @brief Keeps the FAT geometry of a mounted filesystem, without the
+	 * state of the open file (so it doesn't change from boot to boot).
+	 *
+	 * @param fs The mounted filesystem.
+	 */
+	void setFilesystem(const FATFS* fs) {
+		fatfs = *fs;
+		fatfs.flag = 0;
+		fatfs.fptr = 0;
+		fatfs.fsize = 0;
+		fatfs.org_clust = 0;
+		fatfs.curr_clust = 0;
+		fatfs.dsect = 0;
+	}
+
+	byte calcChecksum();
+
+	/**
+	 * @brief Checks the warm boot marker kept in uninitialized RAM. It only
+	 * survives an MCU reset, so it is never set right after power on.
+	 *
+	 * @return true if this is a warm boot.
+	 */
+	bool isWarmBoot();
+
+	/**
+	 * @brief Sets the warm boot marker once the boot has completed.
+	 */
+	void markWarmBoot();
+};
+
+extern HwProfile hwProfile_t;
+#endif
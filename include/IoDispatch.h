@@ -0,0 +1,56 @@
+#ifndef _IO_DISPATCH_H
+#define _IO_DISPATCH_H
+
+#include <Arduino.h>
+
+#define IO_WR_OPCODE_BASE 0x00   // Write OpCodes: 0x00 - 0x3F.
+#define IO_RD_OPCODE_BASE 0x80   // Read OpCodes: 0x80 - 0xBF.
+#define IO_OPCODE_TABLE_SIZE 64
+#define IO_SLOT_WR_OPCODE_BASE 0x40   // Card slot write OpCodes: 0x40 - 0x6F.
+#define IO_SLOT_RD_OPCODE_BASE 0xC0   // Card slot read OpCodes: 0xC0 - 0xEF.
+#define IO_SLOT_COUNT 3
+#define IO_SLOT_REGS 16               // OpCodes per slot and direction (low nibble = card register).
+#define IO_SLOT_NONE 0xFF
+#define IO_OPEN_ENDED 0          // Byte count of OpCodes that end themselves (set ioOpCode to OP_IO_NOP).
+#define IO_STREAMING IO_OPEN_ENDED   // Byte count of OpCodes latched until the next OpCode is stored.
+
+/**
+ * @brief Handles one byte of an OpCode. ioData holds the byte written by the
+ * Z80 (write OpCodes) or receives the byte to return (read OpCodes), and
+ * ioByteCount is the index of the byte in the exchange.
+ */
+typedef void (*IoHandler)();
+
+/**
+ * @brief An OpCode dispatch table entry (stored in PROGMEM). The direction is
+ * given by the table the entry is in.
+ */
+struct IoOpcode {
+	IoHandler handler;   // NULL if the OpCode is not implemented.
+	word byteCount;      // Bytes exchanged before the OpCode ends (1 = single byte).
+};
+
+/**
+ * @brief The OpCode tables of a card type (stored in PROGMEM), indexed by the
+ * card register (the low nibble of a slot OpCode). A card is attached to the
+ * slot it sits in at run time, so the slot OpCodes are dispatched with a
+ * single slot table lookup, however many card types there are.
+ */
+struct IoSlotCard {
+	IoOpcode write[IO_SLOT_REGS];
+	IoOpcode read[IO_SLOT_REGS];
+};
+
+// Expands f(base + 0) ... f(base + 63) to fill a dispatch table at compile time.
+#define IO_TABLE_8(f, base) f((base) + 0), f((base) + 1), f((base) + 2), f((base) + 3), \
+	f((base) + 4), f((base) + 5), f((base) + 6), f((base) + 7)
+#define IO_TABLE_16(f, base) IO_TABLE_8(f, (base) + 0x00), IO_TABLE_8(f, (base) + 0x08)
+#define IO_TABLE_64(f, base) IO_TABLE_8(f, (base) + 0x00), IO_TABLE_8(f, (base) + 0x08), \
+	IO_TABLE_8(f, (base) + 0x10), IO_TABLE_8(f, (base) + 0x18), IO_TABLE_8(f, (base) + 0x20), \
+	IO_TABLE_8(f, (base) + 0x28), IO_TABLE_8(f, (base) + 0x30), IO_TABLE_8(f, (base) + 0x38)
+
+// Registers an OpCode in a constexpr lookup (see ioOpcodeEntry() in main.cpp).
+#define IO_OPCODE(code, fn, count) (opCode == (code)) ? IoOpcode{fn, count} :
+#define IO_OPCODE_END IoOpcode{NULL, 1}
+
+#endif
@@ -0,0 +1,150 @@
+#ifndef _MCP23017_H
+#define _MCP23017_H
+
+#include <Arduino.h>
+#include "hal.h"
+
+// MCP23017 ports.
+#define GPIO_PORT_A 0
+#define GPIO_PORT_B 1
+
+/**
+ * @brief Register level driver for an MCP23017 (IOCON.BANK = 0), on TwiBus.
+ * Works on whole ports, never on single pins: a port write is one posted I2C
+ * write, a port read a single register read.
+ *
+ * IODIR, GPPU and OLAT are shadowed, so writes that don't change them are
+ * skipped and bit operations need no read. The shadows are loaded from the
+ * chip by begin() (it keeps its registers across an MCU reset).
+ *
+ * A failed read returns 0. On a removable card, a read the chip doesn't
+ * acknowledge also marks it as not present until the next begin(), so callers
+ * stop waiting on it. On-board chips stay present: a NACK there is a bus
+ * glitch, not a pulled card.
+ *
+ * NOTE: writeReg() and writeSequence() bypass the shadows. A device should
+ * drive its output latches either through them or through the port writes,
+ * not both.
+ */
+class Mcp23017 {
+public:
+    /**
+     * @param addr The I2C address.
+     * @param removable true if the chip is on a card that can be pulled.
+     */
+    Mcp23017(byte addr, bool removable = false);
+
+    /**
+     * @brief Checks for the chip, sets its bus clock (TWI_FAST_FREQ) and
+     * loads the shadows.
+     *
+     * @return true if the chip was found.
+     */
+    bool begin();
+
+    bool isPresent();
+
+    /**
+     * @brief Writes the output latch of a port.
+     *
+     * @param port GPIO_PORT_A or GPIO_PORT_B.
+     * @param data The value.
+     */
+    void writePort(byte port, byte data);
+
+    /**
+     * @brief Writes both output latches in one transaction (sequential
+     * addressing).
+     *
+     * @param data The GPIOB:GPIOA value.
+     */
+    void writePorts(word data);
+
+    /**
+     * @brief Sets the direction of the pins of a port.
+     *
+     * @param port GPIO_PORT_A or GPIO_PORT_B.
+     * @param data 1 = input, 0 = output.
+     */
+    void setDirection(byte port, byte data);
+
+    /**
+     * @brief Sets the pullups of a port.
+     *
+     * @param port GPIO_PORT_A or GPIO_PORT_B.
+     * @param data 1 = pullup enabled, 0 = pullup disabled.
+     */
+    void setPullups(byte port, byte data);
+
+    void setBits(byte port, byte mask);
+    void clearBits(byte port, byte mask);
+    void toggleBits(byte port, byte mask);
+
+    /**
+     * @brief Reads the pins of a port.
+     *
+     * @param port GPIO_PORT_A or GPIO_PORT_B.
+     * @return byte The value (0 if the chip is not present).
+     */
+    byte readPort(byte port);
+
+    /**
+     * @brief Reads the pins of a port, telling a failed read from a 0.
+     *
+     * @param port GPIO_PORT_A or GPIO_PORT_B.
+     * @param data Receives the value (0 if the read failed).
+     * @return true if the read succeeded.
+     */
+    bool readPort(byte port, byte* data);
+
+    /**
+     * @brief Reads both ports in one transaction (sequential addressing).
+     *
+     * @return word The GPIOB:GPIOA value (0 if the chip is not present).
+     */
+    word readPorts();
+
+    /**
+     * @brief Gets the output latches (from the shadow, no I2C).
+     *
+     * @return word The OLATB:OLATA value.
+     */
+    word latches();
+
+    /**
+     * @brief Gets the pin directions (from the shadow, no I2C).
+     *
+     * @return word The IODIRB:IODIRA value.
+     */
+    word directions();
+
+    /**
+     * @brief Queues a register write, without touching the shadows.
+     *
+     * @param reg The register.
+     * @param data The value.
+     */
+    void writeReg(byte reg, byte data);
+
+    /**
+     * @brief Queues a raw write (register first, then the data), without
+     * touching the shadows.
+     *
+     * @param data The bytes to send.
+     * @param len The number of bytes.
+     */
+    void writeSequence(const byte* data, byte len);
+
+private:
+    void writeShadowed(byte reg, byte* shadow, byte data);
+    void checkStatus(byte status);
+
+    byte _addr;
+    bool _removable;
+    bool _isPresent;
+    byte _iodir[2];
+    byte _gppu[2];
+    byte _olat[2];
+};
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef _SNAPSHOT_H
+#define _SNAPSHOT_H
+
+#include <Arduino.h>
+#include "PetitFS.h"
+
+#define SNAPSHOT_FN "SNAPSHOT.BIN"      // Preallocated snapshot file on SD.
+#define SNAPSHOT_VERSION 2
+#define SNAPSHOT_HDR_SECTORS 1          // The header takes the whole first sector.
+#define SNAPSHOT_REGION_SIZE 0x8000     // Each region is a 32KB half of the address space.
+#define SNAPSHOT_REGIONS 4              // OS banks 0, 1, 2 and the common fixed bank.
+#define SNAPSHOT_FILE_SIZE ((SNAPSHOT_HDR_SECTORS * 512UL) + (SNAPSHOT_REGIONS * (unsigned long)SNAPSHOT_REGION_SIZE))
+
+/**
+ * @brief Snapshot file header (stored at the start of the first sector).
+ */
+struct SnapshotHeader {
+    char magic[4];
+    byte version;
+    word resumeAddr;
+    byte osBank;
+    bool z80IntEnFlag;
+    bool z80IntSysTick;
+    byte sysTickTime;
+    byte diskNum;
+    bool z80IntGpio;
+    word gpioWatch;
+    bool z80IntSlots;
+};
+
+class SnapshotClass {
+public:
+    SnapshotClass();
+
+    /**
+     * @brief Dumps the whole banked RAM and the header to the snapshot file.
+     * The Z80 must be stopped and freshly reset, so the injection path can
+     * be used. On return the OS bank from the header is selected again.
+     * 
+     * @param fatfs The mounted SD filesystem.
+     * @param header The CPU and IOS state to save along with the RAM.
+     * @return byte ERR_DSK_EMU_OK or a Disk Emulation Error Code.
+     */
+    byte save(FATFS* fatfs, SnapshotHeader* header);
+
+    /**
+     * @brief Validates the snapshot file and streams it back into RAM. On
+     * success the OS bank from the header is selected, so the caller only
+     * needs to inject the jump to header->resumeAddr.
+     * 
+     * @param fatfs The mounted SD filesystem.
+     * @param header Receives the saved CPU and IOS state.
+     * @return byte ERR_DSK_EMU_OK or a Disk Emulation Error Code.
+     */
+    byte load(FATFS* fatfs, SnapshotHeader* header);
+
+private:
+    byte open(FATFS* fatfs);
+    void selectRegion(byte region);
+};
+
+extern SnapshotClass Snapshot;
+#endif
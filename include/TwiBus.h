@@ -0,0 +1,193 @@
+#ifndef _TWI_BUS_H
+#define _TWI_BUS_H
+
+#include <Arduino.h>
+#include "hal.h"
+
+#if (TWI_QUEUE_SIZE & (TWI_QUEUE_SIZE - 1)) || (TWI_QUEUE_SIZE > 256)
+    #error "TWI_QUEUE_SIZE must be a power of 2, up to 256"
+#endif
+
+// Transaction status (same values as Wire.endTransmission()).
+#define TWI_OK 0
+#define TWI_ERR_ADDR_NACK 2      // The device did not acknowledge its address.
+#define TWI_ERR_DATA_NACK 3      // The device did not acknowledge a data byte.
+#define TWI_ERR_BUS 4            // Bus error or lost arbitration.
+#define TWI_ERR_TIMEOUT 5        // The transaction ran out of time (TWI_TIMEOUT_US); the bus was recovered.
+
+/**
+ * @brief TWI diagnostic counters, as returned by OP_IO_RD_I2CSTAT (LSB
+ * first). The counters saturate instead of wrapping.
+ */
+struct TwiStats {
+    word errors;       // Failed transactions (timeouts included).
+    word timeouts;     // Transactions aborted by the timeout (each followed by a bus recovery).
+    byte lastError;    // Status of the last failed transaction (TWI_ERR_*, 0 if none).
+};
+
+/**
+ * @brief Interrupt driven TWI (I2C) master, replacing Wire. Transactions are
+ * queued in a ring and run by the TWI interrupt, in order:
+ *
+ * - Posted writes (post()) return as soon as they are queued, so an I/O
+ *   OpCode can release the Z80 from WAIT before the transfer is done. Errors
+ *   are only counted.
+ * - Blocking calls (write(), readRegs(), probe()) wait for all the queued
+ *   transactions, their own included, so reads always see the posted writes.
+ *
+ * The bus clock is switched per transaction to the clock of the device (see
+ * setDeviceClock()), so fast devices don't have to wait for slow ones.
+ * Writes queued between beginBatch() and endBatch() go out as one bus
+ * transaction, joined by repeated STARTs.
+ *
+ * Every transaction has a time budget (TWI_TIMEOUT_US). When a slave holds
+ * the bus (or a card is pulled mid-transfer), the waiting call or the
+ * background service() aborts it: the TWI is reset, SCL is clocked until the
+ * slave releases SDA, a STOP is sent and the queued transactions are dropped
+ * with TWI_ERR_TIMEOUT. So no call waits much longer than the transactions
+ * queued ahead of it.
+ */
+class TwiBusClass {
+public:
+    TwiBusClass();
+
+    /**
+     * @brief Sets up the TWI hardware (TWI_FREQ) and the SDA/SCL pullups.
+     * Frees the bus first if a slave holds SDA low (e.g. after a reset in
+     * the middle of a read).
+     */
+    void begin();
+
+    /**
+     * @brief Checks for a device (address only transaction).
+     *
+     * @param addr The 7 bit device address.
+     * @return true if the device acknowledged.
+     */
+    bool probe(byte addr);
+
+    /**
+     * @brief Sets the bus clock used for a device. Devices without a clock
+     * set use TWI_FREQ.
+     *
+     * @param addr The 7 bit device address.
+     * @param freq The maximum clock of the device (Hz).
+     */
+    void setDeviceClock(byte addr, unsigned long freq);
+
+    /**
+     * @brief Starts a batch: the writes queued until endBatch() are sent as
+     * a single transaction (repeated START between them, one STOP).
+     *
+     * NOTE: Don't call the blocking methods inside a batch. A batch that
+     * doesn't fit in the queue is split.
+     */
+    void beginBatch();
+
+    /**
+     * @brief Ends a batch and starts sending it.
+     */
+    void endBatch();
+
+    /**
+     * @brief Queues a register write and returns without waiting for it.
+     *
+     * @param addr The 7 bit device address.
+     * @param reg The register.
+     * @param data The value.
+     */
+    void post(byte addr, byte reg, byte data);
+
+    /**
+     * @brief Queues a write and returns without waiting for it.
+     *
+     * @param addr The 7 bit device address.
+     * @param data The bytes to send (usually the register first).
+     * @param len The number of bytes [0..63].
+     */
+    void postBytes(byte addr, const byte* data, byte len);
+
+    /**
+     * @brief Writes to a device and waits for the result.
+     *
+     * @param addr The 7 bit device address.
+     * @param data The bytes to send (usually the register first).
+     * @param len The number of bytes [0..63].
+     * @return byte The status (TWI_OK or TWI_ERR_*).
+     */
+    byte write(byte addr, const byte* data, byte len);
+
+    /**
+     * @brief Reads consecutive registers: writes the register pointer, then
+     * reads after a repeated START. Waits for the posted writes first.
+     *
+     * @param addr The 7 bit device address.
+     * @param reg The first register.
+     * @param data Receives the register values.
+     * @param len The number of registers to read (at least 1).
+     * @return byte The status (TWI_OK or TWI_ERR_*). On error data is
+     * zeroed.
+     */
+    byte readRegs(byte addr, byte reg, byte* data, byte len);
+
+    /**
+     * @brief Waits until all the queued transactions are done (or dropped
+     * after a timeout).
+     */
+    void flush();
+
+    /**
+     * @brief Aborts a transaction that ran out of time, when nobody is
+     * waiting for it (posted writes). Called from the I/O loop background
+     * tasks.
+     */
+    void service();
+
+    /**
+     * @brief Gets a consistent copy of the diagnostic counters (posted
+     * transactions included).
+     *
+     * @return TwiStats The counters.
+     */
+    TwiStats stats();
+
+    // Interrupt handler, public only for the ISR.
+    inline void irq() __attribute__((always_inline));
+
+private:
+    void enqueue(byte addr, byte header, const byte* data, byte len);
+    void publish();
+    byte deviceTwbr(byte addr);
+    void startNext(bool stop);
+    void endTransaction(byte status);
+    void countError(byte status);
+    bool checkTimeout();
+    void recover();
+    void clockOut();
+
+    byte _queue[TWI_QUEUE_SIZE];
+    byte _deviceAddr[TWI_MAX_DEVICES];
+    byte _deviceTwbr[TWI_MAX_DEVICES];
+    byte _devices;
+    byte _pendingHead;           // Queue head including the entries of an open batch.
+    bool _batching;
+    bool _batchStarted;
+    volatile byte _head;
+    volatile byte _tail;
+    volatile bool _busy;
+    bool _stopWait;              // Waiting for the last STOP before starting the next transaction.
+    volatile byte _status;
+    volatile unsigned long _txStart;     // micros() at the START of the current transaction.
+    TwiStats _stats;
+
+    // Transaction in progress (owned by the ISR while _busy).
+    byte _addr;
+    byte _txLeft;
+    bool _readPending;
+    bool _reading;
+    byte* _rxBuf;
+    byte _rxLeft;
+};
+
+extern TwiBusClass TwiBus;
+#endif
@@ -0,0 +1,151 @@
+#ifndef _UART_H
+#define _UART_H
+
+#include <Arduino.h>
+#include "hal.h"
+
+#if (UART_RX_BUFFER_SIZE & (UART_RX_BUFFER_SIZE - 1)) || (UART_RX_BUFFER_SIZE > 256)
+    #error "UART_RX_BUFFER_SIZE must be a power of 2, up to 256"
+#endif
+
+#if (UART_TX_BUFFER_SIZE & (UART_TX_BUFFER_SIZE - 1)) || (UART_TX_BUFFER_SIZE > 256)
+    #error "UART_TX_BUFFER_SIZE must be a power of 2, up to 256"
+#endif
+
+#if defined(UART_FLOW_CONTROL) && !(defined(UART_PIN_RTS) && defined(UART_PIN_CTS))
+    #error "UART_FLOW_CONTROL needs UART_PIN_RTS and UART_PIN_CTS"
+#endif
+
+/**
+ * @brief UART diagnostic counters, as returned by OP_IO_RD_UARTSTAT (LSB
+ * first). The counters saturate instead of wrapping.
+ */
+struct UartStats {
+    word rxOverruns;   // Bytes lost because the RX ring or the UART data register was full.
+    word rxErrors;     // Bytes received with a framing or parity error (discarded).
+    word txStalls;     // Writes that had to wait for room in the TX ring.
+};
+
+/**
+ * @brief Interrupt driven driver for the console UART, replacing the Arduino
+ * HardwareSerial. RX and TX go through rings sized at compile time
+ * (UART_RX_BUFFER_SIZE and UART_TX_BUFFER_SIZE in hal.h), with optional
+ * RTS/CTS hardware flow control (UART_FLOW_CONTROL).
+ *
+ * write() never drops a byte: when the TX ring is full it waits for room
+ * (counted as a TX stall). Code on the bus path should check
+ * availableForWrite() (OP_IO_RD_ATXBUFF) or use tryWrite() instead.
+ */
+class UartClass : public Stream {
+public:
+    UartClass();
+
+    /**
+     * @brief Configures the UART (8N1, double speed) and enables it.
+     *
+     * @param baud The BAUD rate.
+     */
+    void begin(unsigned long baud);
+
+    /**
+     * @brief Waits for the TX ring to drain and disables the UART.
+     */
+    void end();
+
+    int available() override;
+    int peek() override;
+    int read() override;
+    int availableForWrite() override;
+
+    /**
+     * @brief Waits until all the pending bytes were sent.
+     */
+    void flush() override;
+
+    size_t write(uint8_t data) override;
+    using Print::write;
+
+    /**
+     * @brief Queues a byte for TX without waiting.
+     *
+     * @param data The byte to send.
+     * @return true if the byte was queued; false if the TX ring is full.
+     */
+    bool tryWrite(byte data);
+
+    /**
+     * @brief Checks the TX ring.
+     *
+     * @return true if the TX ring is full (a write() would stall).
+     */
+    bool isTxFull();
+
+    /**
+     * @brief Resumes TX when the host releases CTS. Called from the I/O loop
+     * background tasks; does nothing without UART_FLOW_CONTROL.
+     */
+    void service();
+
+    /**
+     * @brief Changes the BAUD rate once the bytes already queued are out,
+     * without waiting: the bytes queued from now on are held, and the TX
+     * complete interrupt switches the rate, drops the pending input, sends
+     * a lead byte at the new rate and releases them.
+     *
+     * @param baud The new BAUD rate.
+     * @param lead The first byte sent at the new rate.
+     */
+    void switchBaud(unsigned long baud, byte lead);
+
+    /**
+     * @brief Checks for a switchBaud() still waiting for the old output.
+     *
+     * @return true if the switch is not done yet.
+     */
+    bool isSwitching();
+
+    /**
+     * @brief Checks (and clears) the received flag: set by every byte
+     * received since the last call or the last BAUD rate switch, even if the
+     * byte was read already.
+     *
+     * @return true if a byte was received.
+     */
+    bool checkReceived();
+
+    /**
+     * @brief Gets a consistent copy of the diagnostic counters.
+     *
+     * @return UartStats The counters.
+     */
+    UartStats stats();
+
+    // Interrupt handlers, public only for the ISRs.
+    inline void rxIrq() __attribute__((always_inline));
+    inline void txIrq() __attribute__((always_inline));
+    inline void txcIrq() __attribute__((always_inline));
+
+private:
+    void updateRts();
+    void pollTx();
+    void doSwitch();
+    static word ubrrFor(unsigned long baud);
+    void setUbrr(word ubrr);
+
+    volatile byte _rxHead;
+    volatile byte _rxTail;
+    volatile byte _txHead;
+    volatile byte _txTail;
+    volatile bool _txStarted;
+    volatile bool _txHeld;         // TX stops at _txBarrier until the BAUD rate switch.
+    volatile byte _txBarrier;
+    word _switchUbrr;
+    byte _switchLead;
+    volatile bool _received;
+    byte _rxBuffer[UART_RX_BUFFER_SIZE];
+    byte _txBuffer[UART_TX_BUFFER_SIZE];
+    UartStats _stats;
+};
+
+extern UartClass Uart;
+#endif
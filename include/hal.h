@@ -5,13 +5,34 @@
 #include "PetitFS.h"
 
 #define DEBUG
+#define BOOT_PROFILER    // Time the boot stages (see BootProfiler.h).
 
 /**
  * @brief Hardware definitions for base system.
  */
 
-#define SERIAL_BAUD_RATE 115200  // BAUD rate for the Serial port.
-// TODO Make it possible to change BAUD rate
+#define BAUD_CONFIRM_MS 10000    // Time the host has to confirm a new BAUD rate before it is reverted.
+
+// Console UART (see Uart.h). Ring sizes must be powers of 2, up to 256.
+#define UART_RX_BUFFER_SIZE 128
+#define UART_TX_BUFFER_SIZE 64
+// Uncomment for RTS/CTS hardware flow control (both active LOW). There are
+// no free MCU pins on the stock board, so the pins must be freed up first.
+// #define UART_FLOW_CONTROL
+// #define UART_PIN_RTS x      // Output: LOW when the RX ring has room.
+// #define UART_PIN_CTS x      // Input: TX is paused while HIGH.
+
+// Serial RX IRQ coalescing: /INT is asserted once the RX line has been idle
+// this long, or as soon as the RX buffer is a quarter full.
+#define RX_IRQ_COALESCE_US 200
+#define RX_IRQ_THRESHOLD (UART_RX_BUFFER_SIZE / 4)
+
+// GPIO input sampling (OP_IO_WR_GPIOWATCH): interval between two reads of the
+// expander ports while watched inputs are set.
+#define GPIO_SAMPLE_US 1000
+
+// Card slot hot-plug: interval between two reads of the CPRES lines.
+#define CARD_POLL_MS 100
 
 // Z80 data bus
 #define PIN_D0 24      // PA0 pin 40
@@ -37,6 +58,12 @@
 #define PIN_BUSREQ 14  // PD6 pin 20 - Z80 BUSREQ
 #define PIN_CLK 15     // PD7 pin 21 - Z80 CLK
 
+#define IO_HOLD_TSTATES 3   // Z80 T-states the bus is held while the Z80 exits from an I/O WAIT state.
+
+// Z80 T-state length in MCU cycles for an OCR2 value (Timer2 toggles PIN_CLK
+// every OCR2 + 1 cycles, see startZ80Clock()).
+#define Z80_TSTATE_CYCLES(ocr) (2 * ((ocr) + 1))
+
 // SPI Bus
 #define PIN_SS 4       // PB4 pin 5 - SD SPI - Chip select
 #define PIN_MOSI 5     // PB5 pin 6 - SD SPI - Master Out/Slave In
@@ -46,6 +73,11 @@
 // I2C Bus
 #define PIN_SCL 16     // PC0 pin 22 - Clock
 #define PIN_SDA 17     // PC1 pin 23 - Data
+#define TWI_FREQ 100000L         // I2C bus clock (Hz), for devices without a faster clock set.
+#define TWI_FAST_FREQ 400000L    // Fast mode clock (Hz) for the MCP23017s. Their 1.7MHz is out of reach of the TWI (TWBR >= 10).
+#define TWI_MAX_DEVICES 4        // Devices with their own bus clock (see TwiBus.setDeviceClock()).
+#define TWI_QUEUE_SIZE 64        // TWI transaction ring size (see TwiBus.h). Power of 2, up to 256.
+#define TWI_TIMEOUT_US 10000L    // Time budget of a single I2C transaction (a full 63 byte write at 100kHz takes ~6ms).
 
 // Misc
 #define PIN_IOS_LED 0  // PB0 pin 1 - IOS LED is ON if HIGH
@@ -80,10 +112,13 @@
 #define IODIRA_REG 0x00     // internal register IODIRA
 #define IODIRB_REG 0x01     // internal register IODIRB
 #define GPPUA_REG 0x0C      // internal register GPPUA
+#define IOCON_REG 0x0A      // internal register IOCON
 #define GPPUB_REG 0x0D      // internal register GPPUB
 #define GPIOA_REG 0x12      // internal register GPIOA
 #define GPIOB_REG 0x13      // internal register GPIOB
+#define OLATA_REG 0x14      // internal register OLATA
 #define SPP_ADDR 0x21       // MCP23017 address (on SSP card)
+#define SPP_SPOOL_SIZE 64   // Print spool ring size (see CyBorgSPP.h). Power of 2, up to 256.
 #define BUSCTLR_ADDR 0x22	// MCP23017 address (BUSCTLR)
 
 /**
@@ -111,6 +146,7 @@
 #define AUTOFN "AUTOBOOT.BIN"
 #define Z80DISK "DSxNyy.DSK"
 #define DS_OSNAME "DSxNAM.DAT"
+#define DS_MANIFEST "DSxBOOT.MAN"
 #define BASSTRADDR ZERO_ADDR
 #define FORSTRADDR 0x0100
 #define CPM22CBASE 0xD200
@@ -124,9 +160,13 @@
 
 #define MAX_TRACKS 512
 #define MAX_SECTORS 32
+#define SD_SECTOR_SIZE 512   // Bytes exchanged by the WRTSCT/RDSECT OpCodes.
+#define SD_TRANSFER_SIZE 32   // Default readSD()/writeSD() transfer size. Must divide SD_SECTOR_SIZE.
+#define SD_DISK_BUFFER_SIZE 64   // Disk emulation transfer size (RDSECT/WRTSCT and boot load). Must divide SD_SECTOR_SIZE.
 
 #define KEY_CODE_CR 13
 #define KEY_CODE_ESC 27
+#define KEY_CODE_XON 17          // Sent by IOS when a new BAUD rate takes effect.
 
 #define OS_MEM_BANK_0 0
 #define OS_MEM_BANK_1 1
@@ -182,18 +222,48 @@ void loadHL(word value);
 void loadByteToRAM(byte value);
 
 /**
- * @brief 
+ * @brief Reads the byte at the RAM address pointed by HL by injecting
+ * LD A,(HL) and INC HL, sampling the data bus while the RAM drives it.
  * 
- * @param value 
+ * @return byte The byte read from RAM.
  */
-void printBinaryByte(byte value);
+byte readByteFromRAM();
+
+/**
+ * @brief Injects a JP nn instruction, so the Z80 continues from the given
+ * address once the clock is running again (no RAM is written).
+ * 
+ * @param addr The address to jump to.
+ */
+void injectJump(word addr);
+
+/**
+ * @brief Maps the given OS bank into the lower half of the Z80 address space
+ * (see OP_IO_WR_SETBNK). Bank numbers greater than 2 are ignored.
+ * 
+ * @param osBank The OS bank number [0..2].
+ */
+void setOsBank(byte osBank);
+
+/**
+ * @brief Starts the Z80 clock on PIN_CLK using Timer2 (CTC, toggle on match).
+ * 
+ * @param ocr The OCR2 value (see ClockMode).
+ */
+void startZ80Clock(byte ocr);
+
+/**
+ * @brief Stops the Z80 clock and leaves PIN_CLK LOW, so the Z80 can be
+ * clocked manually again.
+ */
+void stopZ80Clock();
 
 /**
  * @brief 
  * 
- * @param intFlagUsed 
+ * @param value 
  */
-void serialEvent(bool intFlagUsed);
+void printBinaryByte(byte value);
 
 /**
  * @brief 
@@ -209,13 +279,45 @@ void flushSerialRXBuffer();
 void blinkIOSled(unsigned long *timestamp);
 
 /**
- * @brief 
+ * @brief SD filesystem mount state (see mountSD()).
+ */
+enum class SDMountState : uint8_t {
+  UNMOUNTED = 0,  // Never mounted: the next mount fully initializes the card.
+  MOUNTED = 1,    // Mounted: a remount only checks the card status.
+  FAULT = 2       // A disk error happened: the next mount fully initializes the card.
+};
+
+/**
+ * @brief Mounts the SD filesystem. If it is already mounted on the same
+ * FATFS and the card still answers a status check (CMD13), the cached
+ * geometry is kept and only the open file is closed, the same as after a
+ * full mount. The full card initialization and MBR/BPB parsing only run
+ * when unmounted, after a disk error, or when the card was swapped.
  * 
- * @param fatfs 
- * @return byte
+ * @param fatfs The filesystem object.
+ * @return byte ERR_DSK_EMU_OK or an error code.
  */
 byte mountSD(FATFS* fatfs);
 
+/**
+ * @brief Gets the SD filesystem mount state.
+ * 
+ * @return SDMountState The mount state.
+ */
+SDMountState getSDMountState();
+
+/**
+ * @brief Mounts the SD filesystem from saved geometry, without initializing
+ * the card. Works only if the card is still initialized (e.g. after an MCU
+ * reset) and holds the same volume.
+ *
+ * @param fatfs Filesystem object holding the saved geometry.
+ * @param cardType The card type from the previous initialization.
+ * @param volid The expected volume serial number.
+ * @return byte ERR_DSK_EMU_OK or a PetitFS error code (then use mountSD()).
+ */
+byte remountSD(FATFS* fatfs, byte cardType, unsigned long volid);
+
 /**
  * @brief 
  * 
@@ -229,9 +331,10 @@ byte openSD(const char* fileName);
  * 
  * @param buffSD 
  * @param readBytes 
+ * @param len The number of bytes to read (at most 255).
  * @return byte 
  */
-byte readSD(void* buffSD, byte* readBytes);
+byte readSD(void* buffSD, byte* readBytes, byte len = SD_TRANSFER_SIZE);
 
 /**
  * @brief 
@@ -246,9 +349,10 @@ byte seekSD(word sectNum);
  * 
  * @param buffSD 
  * @param numWrittenBytes 
+ * @param len The number of bytes to write (at most 255).
  * @return byte 
  */
-byte writeSD(void* buffSD, byte* numWrittenBytes);
+byte writeSD(void* buffSD, byte* numWrittenBytes, byte len = SD_TRANSFER_SIZE);
 
 /**
  * @brief 
@@ -266,8 +370,26 @@ void printErrSD(byte opType, byte errCode, const char* fileName);
 void waitKeySD();
 
 /**
- * @brief 
- * 
+ * @brief Holds the bus for IO_HOLD_TSTATES Z80 T-states at the running Z80
+ * clock: enough for the Z80 to leave the WAIT state, latch the data of a read
+ * and sample BUSREQ at the end of the I/O cycle. The delay is cycle counted,
+ * so it costs a few hundred ns instead of a fixed worst case wait.
+ */
+inline void holdIoCycle() __attribute__((always_inline));
+inline void holdIoCycle() {
+	if (OCR2 == 0) {
+		// ClockMode::FAST
+		__builtin_avr_delay_cycles(IO_HOLD_TSTATES * Z80_TSTATE_CYCLES(0));
+	}
+	else {
+		// ClockMode::SLOW
+		__builtin_avr_delay_cycles(IO_HOLD_TSTATES * Z80_TSTATE_CYCLES(1));
+	}
+}
+
+/**
+ * @brief Ends an I/O cycle without data (write or interrupt acknowledge):
+ * releases the Z80 from WAIT through a short DMA request.
  */
 void exitWaitState();
 
@@ -2,53 +2,73 @@
 #define _ILOAD_H
 
 #include <Arduino.h>
+#include "BiosSettings.h"
+#include "FlashPayload.h"
+#include "hal.h"
 
 const String compTimeStr = __TIME__;
 const String compDateStr = __DATE__;
 
 const word boot_A_StrAddr = 0xfd10;      // Payload A image starting address (flash)
-const byte boot_A_[] PROGMEM = {         // Payload A image (CyBorg iLoad)
-  0x31, 0x10, 0xFD, 0x21, 0x52, 0xFD, 0xCD, 0xC6, 0xFE, 0xCD, 0x3E, 0xFF, 0xCD, 0xF4, 0xFD, 0x3E, 
-  0xFF, 0xBC, 0x20, 0x10, 0xBD, 0x20, 0x0D, 0x21, 0xD9, 0xFD, 0xCD, 0xC6, 0xFE, 0x21, 0x88, 0xFD, 
-  0xCD, 0xC6, 0xFE, 0x76, 0xE5, 0x21, 0xD9, 0xFD, 0xCD, 0xC6, 0xFE, 0x21, 0x75, 0xFD, 0xCD, 0xC6, 
-  0xFE, 0xE1, 0xCD, 0x4B, 0xFF, 0xCD, 0x3E, 0xFF, 0xCD, 0x3E, 0xFF, 0xDB, 0x01, 0xFE, 0xFF, 0x20, 
-  0xFA, 0xE9, 0x69, 0x4C, 0x6F, 0x61, 0x64, 0x20, 0x2D, 0x20, 0x49, 0x6E, 0x74, 0x65, 0x6C, 0x2D, 
-  0x48, 0x65, 0x78, 0x20, 0x4C, 0x6F, 0x61, 0x64, 0x65, 0x72, 0x20, 0x2D, 0x20, 0x53, 0x32, 0x30, 
-  0x30, 0x37, 0x31, 0x38, 0x00, 0x53, 0x74, 0x61, 0x72, 0x74, 0x69, 0x6E, 0x67, 0x20, 0x41, 0x64, 
-  0x64, 0x72, 0x65, 0x73, 0x73, 0x3A, 0x20, 0x00, 0x4C, 0x6F, 0x61, 0x64, 0x20, 0x65, 0x72, 0x72, 
-  0x6F, 0x72, 0x20, 0x2D, 0x20, 0x53, 0x79, 0x73, 0x74, 0x65, 0x6D, 0x20, 0x68, 0x61, 0x6C, 0x74, 
-  0x65, 0x64, 0x00, 0x57, 0x61, 0x69, 0x74, 0x69, 0x6E, 0x67, 0x20, 0x69, 0x6E, 0x70, 0x75, 0x74, 
-  0x20, 0x73, 0x74, 0x72, 0x65, 0x61, 0x6D, 0x2E, 0x2E, 0x2E, 0x00, 0x53, 0x79, 0x6E, 0x74, 0x61, 
-  0x78, 0x20, 0x65, 0x72, 0x72, 0x6F, 0x72, 0x21, 0x00, 0x43, 0x68, 0x65, 0x63, 0x6B, 0x73, 0x75, 
-  0x6D, 0x20, 0x65, 0x72, 0x72, 0x6F, 0x72, 0x21, 0x00, 0x69, 0x4C, 0x6F, 0x61, 0x64, 0x3A, 0x20, 
-  0x00, 0x41, 0x64, 0x64, 0x72, 0x65, 0x73, 0x73, 0x20, 0x76, 0x69, 0x6F, 0x6C, 0x61, 0x74, 0x69, 
-  0x6F, 0x6E, 0x21, 0x00, 0xF5, 0xD5, 0xC5, 0x01, 0xFF, 0xFF, 0x21, 0xA3, 0xFD, 0xCD, 0xC6, 0xFE, 
-  0xCD, 0x3E, 0xFF, 0xCD, 0x72, 0xFF, 0xFE, 0x0D, 0x28, 0xF9, 0xFE, 0x0A, 0x28, 0xF5, 0xFE, 0x20, 
-  0x28, 0xF1, 0xCD, 0x1A, 0xFF, 0xCD, 0x69, 0xFF, 0xFE, 0x3A, 0xC2, 0xA3, 0xFE, 0xCD, 0xE1, 0xFE, 
-  0x57, 0x1E, 0x00, 0xCD, 0xBE, 0xFE, 0xCD, 0xD6, 0xFE, 0x3E, 0xFF, 0xB8, 0x20, 0x05, 0xB9, 0x20, 
-  0x02, 0x44, 0x4D, 0x7C, 0xCD, 0xBE, 0xFE, 0x7D, 0xCD, 0xBE, 0xFE, 0xCD, 0xE1, 0xFE, 0xCD, 0xBE, 
-  0xFE, 0xFE, 0x01, 0x20, 0x1E, 0xCD, 0xE1, 0xFE, 0xCD, 0xBE, 0xFE, 0x7B, 0xA7, 0x28, 0x66, 0xCD, 
-  0x3E, 0xFF, 0x21, 0xD9, 0xFD, 0xCD, 0xC6, 0xFE, 0x21, 0xC9, 0xFD, 0xCD, 0xC6, 0xFE, 0x01, 0xFF, 
-  0xFF, 0x18, 0x52, 0x7A, 0xA7, 0x28, 0x2C, 0xCD, 0xE1, 0xFE, 0xCD, 0xBE, 0xFE, 0xE5, 0xC5, 0xA7, 
-  0x01, 0xF0, 0xFC, 0xED, 0x42, 0xC1, 0xE1, 0xDA, 0x8E, 0xFE, 0xCD, 0x3E, 0xFF, 0x21, 0xD9, 0xFD, 
-  0xCD, 0xC6, 0xFE, 0x21, 0xE1, 0xFD, 0xCD, 0xC6, 0xFE, 0x01, 0xFF, 0xFF, 0x18, 0x27, 0x77, 0x23, 
-  0x15, 0x18, 0xD0, 0xCD, 0xE1, 0xFE, 0xCD, 0xBE, 0xFE, 0x7B, 0xA7, 0x20, 0xB2, 0xCD, 0x3E, 0xFF, 
-  0xC3, 0x03, 0xFE, 0xCD, 0x3E, 0xFF, 0x21, 0xD9, 0xFD, 0xCD, 0xC6, 0xFE, 0x21, 0xBB, 0xFD, 0xCD, 
-  0xC6, 0xFE, 0x01, 0xFF, 0xFF, 0xCD, 0x3E, 0xFF, 0x60, 0x69, 0xC1, 0xD1, 0xF1, 0xC9, 0xC5, 0x4F, 
-  0x7B, 0x91, 0x5F, 0x79, 0xC1, 0xC9, 0xF5, 0xE5, 0x7E, 0xFE, 0x00, 0x28, 0x06, 0xCD, 0x69, 0xFF, 
-  0x23, 0x18, 0xF5, 0xE1, 0xF1, 0xC9, 0xF5, 0xCD, 0xE1, 0xFE, 0x67, 0xCD, 0xE1, 0xFE, 0x6F, 0xF1, 
-  0xC9, 0xC5, 0xCD, 0xF4, 0xFE, 0xCB, 0x07, 0xCB, 0x07, 0xCB, 0x07, 0xCB, 0x07, 0x47, 0xCD, 0xF4, 
-  0xFE, 0xB0, 0xC1, 0xC9, 0xCD, 0x72, 0xFF, 0xCD, 0x1A, 0xFF, 0xCD, 0x06, 0xFF, 0x30, 0xF5, 0xCD, 
-  0x23, 0xFF, 0xCD, 0x2E, 0xFF, 0xC9, 0xFE, 0x47, 0xD0, 0xFE, 0x30, 0x30, 0x02, 0x3F, 0xC9, 0xFE, 
-  0x3A, 0xD8, 0xFE, 0x41, 0x30, 0x02, 0x3F, 0xC9, 0x37, 0xC9, 0xFE, 0x61, 0xD8, 0xFE, 0x7B, 0xD0, 
-  0xE6, 0x5F, 0xC9, 0xFE, 0x3A, 0x38, 0x02, 0xD6, 0x07, 0xD6, 0x30, 0xE6, 0x0F, 0xC9, 0xF5, 0xE6, 
-  0x0F, 0xC6, 0x30, 0xFE, 0x3A, 0x38, 0x02, 0xC6, 0x07, 0xCD, 0x69, 0xFF, 0xF1, 0xC9, 0xF5, 0x3E, 
-  0x0D, 0xCD, 0x69, 0xFF, 0x3E, 0x0A, 0xCD, 0x69, 0xFF, 0xF1, 0xC9, 0xE5, 0xF5, 0x7C, 0xCD, 0x58, 
-  0xFF, 0x7D, 0xCD, 0x58, 0xFF, 0xF1, 0xE1, 0xC9, 0xF5, 0xC5, 0x47, 0x0F, 0x0F, 0x0F, 0x0F, 0xCD, 
-  0x2E, 0xFF, 0x78, 0xCD, 0x2E, 0xFF, 0xC1, 0xF1, 0xC9, 0xF5, 0x3E, 0x01, 0xD3, 0x01, 0xF1, 0xD3, 
-  0x00, 0xC9, 0xDB, 0x01, 0xFE, 0xFF, 0xCA, 0x72, 0xFF, 0xC9
+const word boot_A_Size = 618;            // Payload A image size (uncompressed)
+const word boot_A_Crc = 0x95E2;          // Payload A image CRC-16/XMODEM (uncompressed)
+const byte boot_A_[] PROGMEM = {         // Payload A image (CyBorg iLoad, LZ compressed with tools/lzpack.py)
+  0xFF, 0x31, 0x10, 0xFD, 0x21, 0x52, 0xFD, 0xCD, 0xC6, 0xFF, 0xFE, 0xCD, 0x3E, 0xFF, 0xCD, 0xF4,
+  0xFD, 0x3E, 0xFF, 0xFF, 0xBC, 0x20, 0x10, 0xBD, 0x20, 0x0D, 0x21, 0x6D, 0xD9, 0x13, 0x01, 0x21,
+  0x88, 0x05, 0x01, 0x76, 0xE5, 0x0D, 0x04, 0xBD, 0x75, 0x05, 0x01, 0xE1, 0xCD, 0x4B, 0xFF, 0x2B,
+  0x01, 0x3E, 0xFF, 0xFF, 0xDB, 0x01, 0xFE, 0xFF, 0x20, 0xFA, 0xE9, 0xFF, 0x69, 0x4C, 0x6F, 0x61,
+  0x64, 0x20, 0x2D, 0x20, 0xFF, 0x49, 0x6E, 0x74, 0x65, 0x6C, 0x2D, 0x48, 0x65, 0xDB, 0x78, 0x20,
+  0x10, 0x01, 0x65, 0x72, 0x12, 0x00, 0x53, 0x32, 0xFF, 0x30, 0x30, 0x37, 0x31, 0x38, 0x00, 0x53,
+  0x74, 0xFF, 0x61, 0x72, 0x74, 0x69, 0x6E, 0x67, 0x20, 0x41, 0xFF, 0x64, 0x64, 0x72, 0x65, 0x73,
+  0x73, 0x3A, 0x20, 0xBD, 0x00, 0x34, 0x02, 0x65, 0x72, 0x72, 0x6F, 0x27, 0x02, 0x79, 0xFF, 0x73,
+  0x74, 0x65, 0x6D, 0x20, 0x68, 0x61, 0x6C, 0x7F, 0x74, 0x65, 0x64, 0x00, 0x57, 0x61, 0x69, 0x2C,
+  0x02, 0xFF, 0x69, 0x6E, 0x70, 0x75, 0x74, 0x20, 0x73, 0x74, 0xFF, 0x72, 0x65, 0x61, 0x6D, 0x2E,
+  0x2E, 0x2E, 0x00, 0xBF, 0x53, 0x79, 0x6E, 0x74, 0x61, 0x78, 0x34, 0x03, 0x21, 0xFF, 0x00, 0x43,
+  0x68, 0x65, 0x63, 0x6B, 0x73, 0x75, 0xFD, 0x6D, 0x0F, 0x05, 0x69, 0x4C, 0x6F, 0x61, 0x64, 0x3A,
+  0xFF, 0x20, 0x00, 0x41, 0x64, 0x64, 0x72, 0x65, 0x73, 0xFF, 0x73, 0x20, 0x76, 0x69, 0x6F, 0x6C,
+  0x61, 0x74, 0xFF, 0x69, 0x6F, 0x6E, 0x21, 0x00, 0xF5, 0xD5, 0xC5, 0xFF, 0x01, 0xFF, 0xFF, 0x21,
+  0xA3, 0xFD, 0xCD, 0xC6, 0xFF, 0xFE, 0xCD, 0x3E, 0xFF, 0xCD, 0x72, 0xFF, 0xFE, 0xFF, 0x0D, 0x28,
+  0xF9, 0xFE, 0x0A, 0x28, 0xF5, 0xFE, 0xFF, 0x20, 0x28, 0xF1, 0xCD, 0x1A, 0xFF, 0xCD, 0x69, 0xFF,
+  0xFF, 0xFE, 0x3A, 0xC2, 0xA3, 0xFE, 0xCD, 0xE1, 0xFF, 0xFE, 0x57, 0x1E, 0x00, 0xCD, 0xBE, 0xFE,
+  0xCD, 0xFF, 0xD6, 0xFE, 0x3E, 0xFF, 0xB8, 0x20, 0x05, 0xB9, 0x5F, 0x20, 0x02, 0x44, 0x4D, 0x7C,
+  0x10, 0x00, 0x7D, 0x14, 0x01, 0x7B, 0xE1, 0xFE, 0x05, 0x00, 0xFE, 0x01, 0x20, 0x1E, 0x09, 0x03,
+  0xFF, 0x7B, 0xA7, 0x28, 0x66, 0xCD, 0x3E, 0xFF, 0x21, 0x7F, 0xD9, 0xFD, 0xCD, 0xC6, 0xFE, 0x21,
+  0xC9, 0x05, 0x01, 0xFF, 0x01, 0xFF, 0xFF, 0x18, 0x52, 0x7A, 0xA7, 0x28, 0xFD, 0x2C, 0x21, 0x03,
+  0xE5, 0xC5, 0xA7, 0x01, 0xF0, 0xFC, 0x7F, 0xED, 0x42, 0xC1, 0xE1, 0xDA, 0x8E, 0xFE, 0x2A, 0x07,
+  0xFD, 0xE1, 0x2A, 0x05, 0x27, 0x77, 0x23, 0x15, 0x18, 0xD0, 0xDE, 0x2B, 0x03, 0x7B, 0xA7, 0x20,
+  0xB2, 0x22, 0x00, 0xC3, 0x03, 0xF2, 0x28, 0x08, 0xBB, 0x28, 0x04, 0x11, 0x00, 0x60, 0x69, 0xC1,
+  0xD1, 0xFF, 0xF1, 0xC9, 0xC5, 0x4F, 0x7B, 0x91, 0x5F, 0x79, 0xFF, 0xC1, 0xC9, 0xF5, 0xE5, 0x7E,
+  0xFE, 0x00, 0x28, 0xFF, 0x06, 0xCD, 0x69, 0xFF, 0x23, 0x18, 0xF5, 0xE1, 0x7F, 0xF1, 0xC9, 0xF5,
+  0xCD, 0xE1, 0xFE, 0x67, 0x03, 0x00, 0x7D, 0x6F, 0x22, 0x00, 0xCD, 0xF4, 0xFE, 0xCB, 0x07, 0x01,
+  0x03, 0xFD, 0x47, 0x0B, 0x00, 0xB0, 0xC1, 0xC9, 0xCD, 0x72, 0xFF, 0xFF, 0xCD, 0x1A, 0xFF, 0xCD,
+  0x06, 0xFF, 0x30, 0xF5, 0xFF, 0xCD, 0x23, 0xFF, 0xCD, 0x2E, 0xFF, 0xC9, 0xFE, 0xFF, 0x47, 0xD0,
+  0xFE, 0x30, 0x30, 0x02, 0x3F, 0xC9, 0xDF, 0xFE, 0x3A, 0xD8, 0xFE, 0x41, 0x08, 0x01, 0x37, 0xC9,
+  0xFF, 0xFE, 0x61, 0xD8, 0xFE, 0x7B, 0xD0, 0xE6, 0x5F, 0xFE, 0x13, 0x00, 0x38, 0x02, 0xD6, 0x07,
+  0xD6, 0x30, 0xE6, 0x7F, 0x0F, 0xC9, 0xF5, 0xE6, 0x0F, 0xC6, 0x30, 0x0F, 0x01, 0xFF, 0xC6, 0x07,
+  0xCD, 0x69, 0xFF, 0xF1, 0xC9, 0xF5, 0xDB, 0x3E, 0x0D, 0x07, 0x00, 0x3E, 0x0A, 0x0C, 0x02, 0xE5,
+  0xF5, 0xDF, 0x7C, 0xCD, 0x58, 0xFF, 0x7D, 0x03, 0x00, 0xF1, 0xE1, 0xDF, 0xC9, 0xF5, 0xC5, 0x47,
+  0x0F, 0x00, 0x00, 0xCD, 0x2E, 0xEB, 0xFF, 0x78, 0x03, 0x00, 0xC1, 0x2A, 0x01, 0x01, 0xD3, 0x01,
+  0xFF, 0xF1, 0xD3, 0x00, 0xC9, 0xDB, 0x01, 0xFE, 0xFF, 0x0F, 0xCA, 0x72, 0xFF, 0xC9
   };
 
-const byte* const flashBootTable[1] PROGMEM = {boot_A_}; // Payload pointers table (flash)
+// Optional resident BASIC/Forth payloads. Generate the header with
+// tools/lzpack.py and add the matching define to build_flags.
+#ifdef RESIDENT_BASIC
+#include "payloadBasic.h"
+#endif
+#ifdef RESIDENT_FORTH
+#include "payloadForth.h"
+#endif
+
+// Resident payloads table (flash). BootMode is stored as a byte.
+const ResidentPayload flashBootTable[] PROGMEM = {
+  {(byte)BootMode::ILOAD, boot_A_StrAddr, boot_A_Size, boot_A_Crc, boot_A_},
+#ifdef RESIDENT_BASIC
+  {(byte)BootMode::BASIC, BASSTRADDR, payloadBasicSize, payloadBasicCrc, payloadBasic},
+#endif
+#ifdef RESIDENT_FORTH
+  {(byte)BootMode::FORTH, FORSTRADDR, payloadForthSize, payloadForthCrc, payloadForth},
+#endif
+};
 
 #endif
\ No newline at end of file
@@ -9,6 +9,7 @@
 #define OPC_INC_HL 0x23         // INC HL
 #define OPC_LD_HL_NN 0x21       // LD HL, nn
 #define OPC_JP_NN 0xC3          // JP nn
+#define OPC_LD_A_HL 0x7E        // LD A, (HL)
 
 /**
  * OpCodes for I/O operations. I/O requests are processed when
@@ -26,6 +27,18 @@
 /**
  * I/O Write OpCodes. All OpCodes except OP_IO_WR_WRTSCT (write sector)
  * only exchange a single byte. WRTSCT can exchange 512 bytes.
+ *
+ * Streaming OpCodes (USR_LED, SER_TX, GPIOA, GPIOB, the GPIO bit operations
+ * and SPP_WR_WRITE) stay
+ * latched until another OpCode is stored, so after a single OUT (1),A every
+ * OUT (0),A executes them again and a whole buffer can be sent with OTIR:
+ *
+ *     LD   A,OP_IO_WR_SER_TX
+ *     OUT  (1),A
+ *     LD   HL,buffer
+ *     LD   B,length
+ *     LD   C,0
+ *     OTIR
  */
 
 // TODO Possible OpCodes to suspend the main CPU to allow add-on cards with
@@ -33,22 +46,30 @@
 
 /**
  * @brief Write USER LED. If Bit 7 (PIN_D0) is HIGH, then LED is ON.
+ *
+ * Streaming OpCode (stays latched until another OpCode is stored).
  */
 #define OP_IO_WR_USR_LED 0x00
 
 /**
  * @brief Write Serial TX. Byte value is considered an ASCII char and is
  * sent to serial.
+ *
+ * Streaming OpCode (stays latched until another OpCode is stored).
  */
 #define OP_IO_WR_SER_TX 0x01
 
 /**
  * @brief Writes the data byte value to GPIOA on the MCP23017.
+ *
+ * Streaming OpCode (stays latched until another OpCode is stored).
  */
 #define OP_IO_WR_GPIOA 0x03
 
 /**
  * @brief Writes the data byte value to GPIOB on the MCP23017.
+ *
+ * Streaming OpCode (stays latched until another OpCode is stored).
  */
 #define OP_IO_WR_GPIOB 0x04
 
@@ -190,7 +211,19 @@
  * x  x  x  x  x  x  x  1   Serial RX IRQ enabled
  * x  x  x  x  x  x  0  x   SYSTICK IRQ not enabled
  * x  x  x  x  x  x  1  x   SYSTICK IRQ enabled
+ * x  x  x  x  x  0  x  x   GPIO IRQ not enabled
+ * x  x  x  x  x  1  x  x   GPIO IRQ enabled
+ * x  x  x  x  0  x  x  x   Card slot IRQ not enabled
+ * x  x  x  x  1  x  x  x   Card slot IRQ enabled
+ *
+ * NOTE: The GPIO IRQ is raised when a pin watched with OP_IO_WR_GPIOWATCH
+ * changes. The card slot IRQ is raised when a card is inserted or removed
+ * (see OP_IO_RD_SLOTS).
  * 
+ * NOTE: The Serial RX IRQ is raised when RX data is waiting. Bytes arriving
+ * in a burst are coalesced into a single IRQ (raised when the line goes idle
+ * for RX_IRQ_COALESCE_US or the RX buffer is a quarter full), so the ISR
+ * should read until SYSFLG reports the RX buffer empty.
  * NOTE: See OP_IO_RD_SYSIRQ for more detail.
  */
 #define OP_IO_WR_SETIRQ 0x0E
@@ -219,6 +252,109 @@
  */
 #define OP_IO_WR_BEEPSTOP 0x21
 
+/**
+ * @brief RAM SNAPSHOT. Hibernate the Z80: dump the whole banked RAM to the
+ * preallocated SNAPSHOT.BIN file on SD and resume execution. The resume
+ * address is exchanged as a word split into a 2-byte sequence (DATA 0 = LSB,
+ * DATA 1 = MSB). After the MSB is written, IOS stops the Z80 clock, resets
+ * the Z80 (RAM contents are preserved), reads back all the 3 OS banks plus the
+ * common fixed bank, then restores the selected OS bank and jumps to the
+ * resume address. The same jump is performed when booting in "resume" mode
+ * (see BootMode::RESUME), so the resume address is where the system comes back
+ * both after the snapshot is taken and at every resumed boot.
+ *
+ * The Z80 side must save its registers (SP included) in RAM *before* the
+ * HIBERNATE operation, then execute DI and HALT right after writing the MSB.
+ * The code at the resume address must restore the registers, the interrupt
+ * mode and re-enable interrupts, since the Z80 comes out of a reset.
+ * The IRQ settings (see OP_IO_WR_SETIRQ and OP_IO_WR_SETTICK), the OS bank
+ * and the selected disk (see OP_IO_WR_SELDSK) are saved and restored by IOS.
+ *
+ * NOTE: SNAPSHOT.BIN must already exist on SD and be at least 131584 bytes
+ * long (512 bytes header + 4 x 32KB banks), since files can't be created or
+ * extended.
+ * NOTE: The result is stored in diskErr (see OP_IO_RD_ERRDSK OpCode), so it
+ * can be checked by the code at the resume address.
+ */
+#define OP_IO_WR_HIBERNATE 0x22
+
+/**
+ * @brief Change the console BAUD rate:
+ * D7 D6 D5 D4 D3 D2 D1 D0
+ * ----------------------------------------------------------
+ * x  0  0  0  0  0  0  0   9600
+ * x  0  0  0  0  0  0  1   19200
+ * x  0  0  0  0  0  1  0   38400
+ * x  0  0  0  0  0  1  1   57600
+ * x  0  0  0  0  1  0  0   115200 (default)
+ * x  0  0  0  0  1  0  1   250000
+ * x  0  0  0  0  1  1  0   500000
+ * x  0  0  0  0  1  1  1   1000000 (not available with a 20MHz MCU clock)
+ * 0  x  x  x  x  x  x  x   Use the new rate until reset
+ * 1  x  x  x  x  x  x  x   Also store it as the BIOS setting once confirmed
+ *
+ * IOS sends all pending output at the old rate, drops pending input, switches
+ * and sends XON (0x11) at the new rate to tell the host it took effect. The
+ * Z80 is released at once: output written while the old output is still
+ * going out is held and follows the XON at the new rate. The host must then
+ * send a byte at the new rate within BAUD_CONFIRM_MS (10s); otherwise IOS
+ * switches back to the old rate (and sends XON again).
+ *
+ * NOTE: Unsupported rates are ignored.
+ */
+#define OP_IO_WR_SETBAUD 0x13
+
+/**
+ * @brief Writes GPIOA and GPIOB on the MCP23017 in a single I2C transaction,
+ * in 2 bytes:
+ * Byte 0 = GPIOA
+ * Byte 1 = GPIOB (both ports are written when this byte is received)
+ *
+ * NOTE: Like the other MCP23017 writes, a write that doesn't change the port
+ * latches (or the IODIR and GPPU registers) is not sent to the chip.
+ */
+#define OP_IO_WR_GPIOAB 0x14
+
+/**
+ * @brief GPIO bit operations: set, clear or toggle the bits of the data byte
+ * (mask) in the GPIOA or GPIOB output latch on the MCP23017. The firmware
+ * applies the mask to its copy of the latch, so a pin changes with a single
+ * I/O write and a single I2C write (no read-modify-write from the Z80).
+ *
+ * Streaming OpCodes (stay latched until another OpCode is stored), e.g. to
+ * pulse a clock line on GPIOA bit 0:
+ *
+ *     LD   A,OP_IO_WR_GPIOA_TGL
+ *     OUT  (1),A
+ *     LD   A,0x01
+ *     OUT  (0),A      ; high
+ *     OUT  (0),A      ; low
+ *
+ * NOTE: A mask that changes nothing is not sent to the chip.
+ */
+#define OP_IO_WR_GPIOA_SET 0x15
+#define OP_IO_WR_GPIOA_CLR 0x16
+#define OP_IO_WR_GPIOA_TGL 0x17
+#define OP_IO_WR_GPIOB_SET 0x18
+#define OP_IO_WR_GPIOB_CLR 0x19
+#define OP_IO_WR_GPIOB_TGL 0x1A
+
+/**
+ * @brief Sets the GPIO input pins watched by IOS, in 2 bytes:
+ * Byte 0 = GPIOA pins mask
+ * Byte 1 = GPIOB pins mask (the masks take effect when this byte is received)
+ *
+ * While any pin is watched, IOS reads both ports in the background every
+ * GPIO_SAMPLE_US (1ms), and OP_IO_RD_GPIOA, OP_IO_RD_GPIOB and OP_IO_RD_GPIOAB
+ * return the last sample at once (output pins read back the output latch)
+ * instead of waiting for an I2C read. When a watched pin changes, the GPIO IRQ
+ * is raised (if enabled with OP_IO_WR_SETIRQ), so the Z80 can wait for input
+ * events instead of polling. Masks of 0x00 stop the sampling.
+ *
+ * NOTE: Pulses shorter than the sampling interval may be missed.
+ */
+#define OP_IO_WR_GPIOWATCH 0x1B
+
 /**
  * I/O Read OpCodes. Follows the same semantics as I/O Write OpCodes.
  * All OpCodes except OP_IO_RD_RDSECT only exchange a single byte. RDSECT can
@@ -242,12 +378,16 @@
 /**
  * @brief Read GPIOA on the MCP23017.
  * NOTE: A value of 0x00 is forced if the MCP23017 is not detected.
+ * NOTE: Served from the last background sample while GPIO pins are watched
+ * (see OP_IO_WR_GPIOWATCH).
  */
 #define OP_IO_RD_GPIOA 0x81
 
 /**
  * @brief Read GPIOB on the MCP23017.
  * NOTE: A value of 0x00 is forced if the MCP23017 is not detected.
+ * NOTE: Served from the last background sample while GPIO pins are watched
+ * (see OP_IO_WR_GPIOWATCH).
  */
 #define OP_IO_RD_GPIOB 0x82
 
@@ -263,8 +403,10 @@
  * x  x  x  x  x  1  x  x   Serial RX char available
  * x  x  x  x  0  x  x  x   Previous RX char valid
  * x  x  x  x  1  x  x  x   Previous RX char was a "buffer empty" flag
+ * x  x  x  0  x  x  x  x   Serial TX buffer has room
+ * x  x  x  1  x  x  x  x   Serial TX buffer full (a SER_TX write would wait)
  * 
- * NOTE: Currently only D0 - D3 are used.
+ * NOTE: Currently only D0 - D4 are used.
  */
 #define OP_IO_RD_SYSFLG 0x83
 
@@ -306,6 +448,7 @@
  *       17        | Illegal track number.
  *       18        | Illegal sector number.
  *       19        | Reached an unexpected EOF.
+ *       20        | Missing, too small or invalid RAM snapshot file.
  * 
  * NOTE: ERRDSK code is referred to the previous SELDSK, SELSCT, SELTRK,
  * WRTSCT, or RDSECT operation.
@@ -340,6 +483,9 @@
  * NOTE: For error codes explanation see OP_IO_RD_ERRDSK OpCode.
  * NOTE: Only for this disk OpCode, the resulting error is read as a data
  * byte without using the OP_IO_RD_ERRDSK OpCode.
+ * NOTE: If the volume is already mounted and the card still answers a status
+ * check, the mount is kept (cheap). The card is fully re-initialized only
+ * after a disk error or a card swap.
  */
 #define OP_IO_RD_SDMNT 0x87
 
@@ -348,7 +494,8 @@
  * NOTE: This OpCode is intended to help avoid delays in Serial TX operations,
  * as IOS holds the Z80 in a wait status if the TX buffer is full. This is no
  * good in multitasking environments. Using this OpCode, we can poll the buffer
- * before transmit.
+ * before transmit. Up to this many bytes can then be sent without a wait
+ * (UART_TX_BUFFER_SIZE - 1 at most).
  */
 #define OP_IO_RD_ATXBUFF 0x88
 
@@ -360,6 +507,10 @@
  * x  x  x  x  x  x  x  1   Serial RX IRQ set
  * x  x  x  x  x  x  0  x   SYSTICK IRQ not set
  * x  x  x  x  x  x  1  x   SYSTICK IRQ set
+ * x  x  x  x  x  0  x  x   GPIO IRQ not set
+ * x  x  x  x  x  1  x  x   GPIO IRQ set (a watched GPIO input changed)
+ * x  x  x  x  0  x  x  x   Card slot IRQ not set
+ * x  x  x  x  1  x  x  x   Card slot IRQ set (a card was inserted or removed)
  *
  * The /INT signal is shared among various interrupt requests. This allows the
  * use of the simplified "Mode 1" scheme of the Z80 CPU (fixed jump to 0x0038 on
@@ -373,6 +524,8 @@
  * 
  * NOTE: Only D0 and D1 "Interrupt Status Bits" are currently used.
  * NOTE: After the SYSIRQ call, all the "Interrupt Status Bits" are cleared.
+ * NOTE: A Serial RX read (I/O read at address 0x01) also clears D0; the IRQ
+ * is raised again if RX data is still waiting.
  * NOTE: The /INT signal is always reset (set HIGH) after this I/O operation,
  * so you always have to call it from inside the ISR (on the Z80 side) before,
  * in order to re-enable the Z80 IRQ again.
@@ -385,27 +538,148 @@
  * - Configure onboard MCP23017 to operate as SPP.
  * - The STROBE (active low) Control Line of the SPP port is set to High;
  * - D0 is used to set the status of AUTOFD (active Low) Control Line of the SPP port (AUTOFD = !D0);
+ * - D1 = 1 enables the print spool status bits of OP_SPP_RD_READ (D1/D2). With D1 = 0 they read
+ *   0, as in older IOS versions;
  * - The printer is initialized with a pulse on the INIT (active Low) Control line of the SPP port.
+ * - The bytes still in the print spool are dropped.
  */
 #define OP_SPP_WR_INIT 0x11
 
 /**
  * @brief Sends a byte to the printer attached to the SPP port. This OpCode is ignored if SPP card
- * is not present. No check is done here to know if the printer is ready or not, so you have to use the
- * OP_SPP_RD_READ OpCode before for that.
+ * is not present. The byte is appended to a print spool (SPP_SPOOL_SIZE bytes) that IOS sends to
+ * the printer in the background, each time it is ready (BUSY low, ACK high). The Z80 only waits
+ * if the spool is full (see OP_SPP_RD_READ D1/D2, enabled by OP_SPP_WR_INIT D1).
  * 
  * NOTE: to use OP_SPP_WR_WRITE the OP_SPP_WR_INIT OpCode should be called first to init the SPP card.
+ *
+ * Streaming OpCode (stays latched until another OpCode is stored).
  */
 #define OP_SPP_WR_WRITE 0x12
 
 /**
  * @brief Read the Status Lines of the SPP Port and the SPP emulation status. This OpCode is
  * ignored if the SPP card is not present.
+ * D7 D6 D5 D4 D3 D2 D1 D0
+ * ----------------------------------------------------------
+ * x  x  x  x  x  x  x  1   SPP emulation present
+ * x  x  x  x  x  x  1  x   Print spool not empty (printing)
+ * x  x  x  x  x  1  x  x   Print spool full (OP_SPP_WR_WRITE would wait)
+ * ?  ?  ?  ?  ?  x  x  x   SPP status lines (GPA3 - GPA7: D6 = BUSY, D7 = ACK)
  * 
  * NOTE: The SPP must be initialized first using OP_SPP_WR_INIT.
+ * NOTE: D1 and D2 are always 0 unless OP_SPP_WR_INIT was called with D1 = 1, so
+ * drivers written for older IOS versions see the same values.
  */
 #define OP_SPP_RD_READ 0x8A
 
+/**
+ * @brief Read the boot report: the timings of the last boots recorded by the
+ * boot profiler (see BootProfiler.h).
+ *
+ * byte 0          Number of boot records (N)
+ * byte 1          Size of a boot record in bytes (S)
+ * byte 2..        N boot records of S bytes each, newest (current boot) first:
+ *                 seq (2 bytes), total us (4 bytes), then 4 bytes per BootStep.
+ *                 All values are LSB first. A seq of 0xFFFF marks an unused record.
+ *
+ * NOTE: Reading past the end of the report returns 0x00. Returns N = 0 if the
+ * firmware was built without BOOT_PROFILER.
+ */
+#define OP_IO_RD_BOOTREP 0x8B
+
+/**
+ * @brief Read the console UART diagnostic counters, in 6 bytes (LSB first):
+ * Bytes 0-1 = RX overruns (bytes lost: RX buffer or UART data register full)
+ * Bytes 2-3 = RX errors (bytes discarded on a framing or parity error)
+ * Bytes 4-5 = TX stalls (SER_TX writes that held the Z80 until the TX buffer
+ *             had room; see OP_IO_RD_ATXBUFF)
+ *
+ * NOTE: The counters count from boot and stop at 0xFFFF.
+ */
+#define OP_IO_RD_UARTSTAT 0x8C
+
+/**
+ * @brief Read GPIOA and GPIOB on the MCP23017 in a single I2C transaction,
+ * in 2 bytes:
+ * Byte 0 = GPIOA (both ports are sampled when this byte is read)
+ * Byte 1 = GPIOB
+ *
+ * NOTE: A value of 0x00 is forced if the MCP23017 is not detected.
+ * NOTE: Served from the last background sample while GPIO pins are watched
+ * (see OP_IO_WR_GPIOWATCH).
+ */
+#define OP_IO_RD_GPIOAB 0x8D
+
+/**
+ * @brief Read the card slots with a card present (and enabled):
+ * D7 D6 D5 D4 D3 D2 D1 D0
+ * ----------------------------------------------------------
+ * x  x  x  x  x  x  x  0   Slot 1 empty
+ * x  x  x  x  x  x  x  1   Slot 1 present
+ * x  x  x  x  x  x  0  x   Slot 2 empty
+ * x  x  x  x  x  x  1  x   Slot 2 present
+ * x  x  x  x  x  0  x  x   Slot 3 empty
+ * x  x  x  x  x  1  x  x   Slot 3 present
+ * 0  0  0  0  0  x  x  x   Unused (always 0)
+ *
+ * IOS polls the card presence lines every CARD_POLL_MS (100ms) and enables
+ * or disables the slots as cards come and go. Served from memory (no I2C).
+ * NOTE: Always 0x00 if the bus controller is not detected.
+ */
+#define OP_IO_RD_SLOTS 0x8E
+
+/**
+ * @brief Read the I2C bus diagnostic counters, in 5 bytes (LSB first):
+ * Bytes 0-1 = Errors (failed transactions: no ACK, bus error or timeout)
+ * Bytes 2-3 = Timeouts (transactions over TWI_TIMEOUT_US, 10ms; each one is
+ *             followed by a bus recovery and drops the queued transactions)
+ * Byte 4    = Status of the last failed transaction:
+ *             2 = address NACK (device missing)
+ *             3 = data NACK
+ *             4 = bus error or lost arbitration
+ *             5 = timeout
+ *
+ * Every I2C access (GPIO, SPP, RTC and bus controller OpCodes) is bounded by
+ * the timeout, so a hung device or a card pulled mid-transfer can't hold the
+ * Z80 in WAIT. A failed read returns 0x00.
+ *
+ * NOTE: The counters count from boot and stop at 0xFFFF. Posted writes fail
+ * silently: these counters are the only trace of them.
+ */
+#define OP_IO_RD_I2CSTAT 0x8F
+
+/**
+ * Card slot OpCodes. Each card slot gets 16 write OpCodes and 16 read OpCodes
+ * for the registers of the card in it: the high nibble selects the slot, the
+ * low nibble the card register.
+ *
+ * Slot   Write OpCodes   Read OpCodes
+ * 1      0x40 - 0x4F     0xC0 - 0xCF
+ * 2      0x50 - 0x5F     0xD0 - 0xDF
+ * 3      0x60 - 0x6F     0xE0 - 0xEF
+ *
+ * IOS attaches the registers of a known card type to the slot it found the
+ * card in, so software can address a card through its slot. The slots are
+ * found at boot. A card inserted later is only attached if it is the only
+ * card present; otherwise its slot is known again after the next reset.
+ * OpCodes of an empty slot, or of a card type IOS doesn't know, are ignored
+ * (reads return 0x00). The register semantics are given per card type
+ * below (SLOT_<card>_WR_* and SLOT_<card>_RD_*).
+ */
+#define OP_SLOT_WR(slot, reg) (0x40 + (((slot) - 1) << 4) + (reg))
+#define OP_SLOT_RD(slot, reg) (0xC0 + (((slot) - 1) << 4) + (reg))
+
+/**
+ * @brief SPP card registers (same semantics as the global OpCodes):
+ * Write register 0 = OP_SPP_WR_INIT
+ * Write register 1 = OP_SPP_WR_WRITE (streaming)
+ * Read register 0 = OP_SPP_RD_READ
+ */
+#define SLOT_SPP_WR_INIT 0x00
+#define SLOT_SPP_WR_WRITE 0x01
+#define SLOT_SPP_RD_READ 0x00
+
 /**
  * @brief Reserved as No-Op.
  */
@@ -440,6 +714,8 @@
 #define ERR_DSK_EMU_ILLEGAL_TRK_NUM 17
 #define ERR_DSK_EMU_ILLEGAL_SCT_NUM 18
 #define ERR_DSK_EMU_UNEXPECTED_EOF 19
+#define ERR_DSK_EMU_BAD_SNAPSHOT 20
+#define ERR_DSK_EMU_BAD_MANIFEST 21
 
 
 #endif
\ No newline at end of file
@@ -22,6 +22,7 @@ public:
 	void update();
 	void save();
 	bool autoSet();
+	bool isPresent();
 	void printDateTime(bool readDone);
 	bool isLeapYear(byte year);
 	void print2Digit(byte data);
@@ -36,6 +36,7 @@ BYTE rcv_spi (void);		/* usi.S: Send a 0xFF to the MMC and get the received byte
 #define CMD1	(0x40+1)	/* SEND_OP_COND (MMC) */
 #define	ACMD41	(0xC0+41)	/* SEND_OP_COND (SDC) */
 #define CMD8	(0x40+8)	/* SEND_IF_COND */
+#define CMD13	(0x40+13)	/* SEND_STATUS */
 #define CMD16	(0x40+16)	/* SET_BLOCKLEN */
 #define CMD17	(0x40+17)	/* READ_SINGLE_BLOCK */
 #define CMD24	(0x40+24)	/* WRITE_BLOCK */
@@ -155,6 +156,59 @@ DSTATUS disk_initialize (void)
 
 
 
+/*-----------------------------------------------------------------------*/
+/* Check the initialized card is still there and ready (CMD13)           */
+/*-----------------------------------------------------------------------*/
+
+DSTATUS disk_status (void)
+{
+	BYTE res;
+
+
+	if (!CardType) return STA_NOINIT;
+#if _USE_WRITE
+	if (SELECTING) return 0;	/* A sector write is in progress, the card is busy with us */
+#endif
+
+	res = send_cmd(CMD13, 0);	/* SEND_STATUS: R1 */
+	if (res == 0) res = rcv_spi();	/* R2 */
+	DESELECT();
+	rcv_spi();
+
+	return res ? STA_NOINIT : 0;
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Take over a card that is still initialized (e.g. after an MCU reset)  */
+/*-----------------------------------------------------------------------*/
+
+DSTATUS disk_resume (
+	BYTE ty		/* Card type found by the last disk_initialize() */
+)
+{
+	init_spi();
+	DESELECT();
+	CardType = ty;
+	if (disk_status()) CardType = 0;
+
+	return CardType ? 0 : STA_NOINIT;
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Get the card type found by disk_initialize() (0: not initialized)     */
+/*-----------------------------------------------------------------------*/
+
+BYTE disk_cardtype (void)
+{
+	return CardType;
+}
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Read partial sector                                                   */
 /*-----------------------------------------------------------------------*/
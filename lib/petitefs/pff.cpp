@@ -812,6 +812,7 @@ FRESULT pf_mount (
 	else
 		fs->dirbase = fs->fatbase + fsize;				/* Root directory start sector (lba) */
 	fs->database = fs->fatbase + fsize + fs->n_rootdir / 16;	/* Data start sector (lba) */
+	fs->bsect = bsect;
 
 	fs->flag = 0;
 	FatFs = fs;
@@ -822,6 +823,87 @@ FRESULT pf_mount (
 
 
 
+/*-----------------------------------------------------------------------*/
+/* Get the Volume Serial Number of the Mounted Drive                     */
+/*-----------------------------------------------------------------------*/
+
+FRESULT pf_volid (
+	DWORD* volid	/* Pointer to the returned volume serial number */
+)
+{
+	BYTE buf[4];
+	FATFS *fs = FatFs;
+
+
+	if (!fs) return FR_NOT_ENABLED;		/* Check file system */
+
+	if (disk_readp(buf, fs->bsect, (fs->fs_type == FS_FAT32) ? BS_VolID32 : BS_VolID, 4))
+		return FR_DISK_ERR;
+	*volid = LD_DWORD(buf);
+
+	return FR_OK;
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Mount a Logical Drive from a Saved File System Object                 */
+/*-----------------------------------------------------------------------*/
+/* The card must be ready (disk_resume() or disk_initialize()) and fs
+   must hold the geometry of a previous pf_mount(). Only the volume serial
+   number is read back to make sure it is still the same volume.          */
+
+FRESULT pf_remount (
+	FATFS *fs,		/* Pointer to the saved file system object */
+	DWORD volid		/* Expected volume serial number */
+)
+{
+	DWORD id;
+	FRESULT res;
+
+
+	FatFs = 0;
+	if (!fs->fs_type || !fs->csize) return FR_NO_FILESYSTEM;
+
+	fs->flag = 0;
+	FatFs = fs;
+	res = pf_volid(&id);
+	if (res == FR_OK && id != volid) res = FR_NO_FILESYSTEM;
+	if (res != FR_OK) FatFs = 0;
+
+	return res;
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Open a File by its Start Cluster and Size (from a previous pf_open)   */
+/*-----------------------------------------------------------------------*/
+
+FRESULT pf_reopen (
+	CLUST sclust,	/* File start cluster */
+	DWORD fsize		/* File size */
+)
+{
+	FATFS *fs = FatFs;
+
+
+	if (!fs) return FR_NOT_ENABLED;		/* Check file system */
+	if (sclust < 2 || sclust >= fs->n_fatent) return FR_NO_FILE;
+
+	fs->org_clust = sclust;				/* File start cluster */
+	fs->fsize = fsize;					/* File size */
+	fs->fptr = 0;						/* File pointer */
+	fs->flag = FA_OPENED;
+
+	return FR_OK;
+}
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Open or Create a File                                                 */
 /*-----------------------------------------------------------------------*/
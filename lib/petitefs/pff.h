@@ -52,6 +52,7 @@ typedef struct {
 	CLUST	org_clust;	/* File start cluster */
 	CLUST	curr_clust;	/* File current cluster */
 	DWORD	dsect;		/* File current data sector */
+	DWORD	bsect;		/* Boot (volume) sector */
 } FATFS;
 
 
@@ -98,7 +99,10 @@ typedef enum {
 /* Petit FatFs module application interface                     */
 
 FRESULT pf_mount (FATFS* fs);								/* Mount/Unmount a logical drive */
+FRESULT pf_remount (FATFS* fs, DWORD volid);				/* Mount a logical drive from a saved FATFS */
+FRESULT pf_volid (DWORD* volid);							/* Get the volume serial number */
 FRESULT pf_open (const char* path);							/* Open a file */
+FRESULT pf_reopen (CLUST sclust, DWORD fsize);				/* Open a file by its start cluster */
 FRESULT pf_read (void* buff, UINT btr, UINT* br);			/* Read data from the open file */
 FRESULT pf_write (const void* buff, UINT btw, UINT* bw);	/* Write data to the open file */
 FRESULT pf_lseek (DWORD ofs);								/* Move file pointer of the open file */
@@ -0,0 +1,206 @@
+#include "BootManifest.h"
+#include "hal.h"
+#include "Uart.h"
+#include "opcodes.h"
+
+#define FIELD_FILE 0
+#define FIELD_BANK 1
+#define FIELD_ADDR 2
+#define FIELD_DONE 3
+
+static byte hexDigit(char c) {
+    if ((c >= '0') && (c <= '9')) {
+        return c - '0';
+    }
+
+    c &= ~0x20;  // Upper case
+    if ((c >= 'A') && (c <= 'F')) {
+        return c - 'A' + 10;
+    }
+
+    return 0xFF;
+}
+
+BootManifestClass::BootManifestClass() {
+    this->_numSegments = 0;
+    this->_entryBank = OS_MEM_BANK_0;
+    this->_entryAddr = ZERO_ADDR;
+    this->_lastFileName[0] = 0;
+}
+
+byte BootManifestClass::parse(const char* manifestName, BootSegment* segments) {
+    byte buffer[SD_TRANSFER_SIZE];
+    byte numBytes = 0;
+    byte field = FIELD_FILE;
+    byte nameLen = 0;
+    bool inToken = false;
+    bool inComment = false;
+    bool hasEntry = false;
+    BootSegment line = {{0}, 0, 0};
+
+    this->_numSegments = 0;
+    byte errCode = openSD(manifestName);
+    while (!errCode) {
+        errCode = readSD(buffer, &numBytes);
+        if (errCode) {
+            break;
+        }
+
+        // A short read is the end of file. Terminate the last line there.
+        bool endOfFile = (numBytes < SD_TRANSFER_SIZE);
+        if (endOfFile) {
+            buffer[numBytes++] = '\n';
+        }
+
+        for (byte i = 0; i < numBytes; i++) {
+            char c = (char)buffer[i];
+            if (inComment && (c != '\n')) {
+                continue;
+            }
+
+            if ((c == '#') || (c == ';')) {
+                inComment = true;
+                c = ' ';
+            }
+
+            if ((c == ' ') || (c == '\t') || (c == '\r') || (c == '\n')) {
+                if (inToken) {
+                    inToken = false;
+                    field++;
+                }
+
+                if (c != '\n') {
+                    continue;
+                }
+
+                // End of line.
+                inComment = false;
+                if (field == FIELD_FILE) {
+                    continue;  // Blank or comment line
+                }
+
+                if ((field != FIELD_DONE) || (line.osBank > OS_MEM_BANK_2)) {
+                    return ERR_DSK_EMU_BAD_MANIFEST;
+                }
+
+                if (strcmp(line.fileName, BOOT_MANIFEST_ENTRY) == 0) {
+                    this->_entryBank = line.osBank;
+                    this->_entryAddr = line.addr;
+                    hasEntry = true;
+                }
+                else {
+                    if (this->_numSegments == BOOT_MANIFEST_MAX_SEGMENTS) {
+                        return ERR_DSK_EMU_BAD_MANIFEST;
+                    }
+
+                    segments[this->_numSegments++] = line;
+                }
+
+                field = FIELD_FILE;
+                nameLen = 0;
+                line.osBank = 0;
+                line.addr = 0;
+                continue;
+            }
+
+            inToken = true;
+            switch (field) {
+                case FIELD_FILE:
+                    if (nameLen == (sizeof(line.fileName) - 1)) {
+                        return ERR_DSK_EMU_BAD_MANIFEST;
+                    }
+
+                    line.fileName[nameLen++] = c;
+                    line.fileName[nameLen] = 0;
+                    break;
+                case FIELD_BANK:
+                    if ((c < '0') || (c > '9')) {
+                        return ERR_DSK_EMU_BAD_MANIFEST;
+                    }
+
+                    line.osBank = (line.osBank * 10) + (c - '0');
+                    break;
+                case FIELD_ADDR:
+                    if ((hexDigit(c) == 0xFF) || (line.addr & 0xF000)) {
+                        return ERR_DSK_EMU_BAD_MANIFEST;
+                    }
+
+                    line.addr = (line.addr << 4) | hexDigit(c);
+                    break;
+                default:
+                    return ERR_DSK_EMU_BAD_MANIFEST;
+            }
+        }
+
+        if (endOfFile) {
+            break;
+        }
+    }
+
+    if (!errCode && !this->_numSegments) {
+        errCode = ERR_DSK_EMU_BAD_MANIFEST;
+    }
+
+    if (!errCode && !hasEntry) {
+        this->_entryBank = segments[0].osBank;
+        this->_entryAddr = segments[0].addr;
+    }
+
+    return errCode;
+}
+
+byte BootManifestClass::loadSegment(const BootSegment* segment) {
+    byte buffer[SD_TRANSFER_SIZE];
+    byte numBytes = 0;
+    strcpy(this->_lastFileName, segment->fileName);
+    byte errCode = openSD(segment->fileName);
+    if (errCode) {
+        return errCode;
+    }
+
+    #ifdef DEBUG
+    Uart.print(F("INIT: boot4 - IOS: Loading "));
+    Uart.print(segment->fileName);
+    Uart.print(F(" -> bank "));
+    Uart.print(segment->osBank);
+    Uart.print(F(" @ 0x"));
+    Uart.println(segment->addr, HEX);
+    #endif
+
+    setOsBank(segment->osBank);
+    loadHL(segment->addr);
+    do {
+        errCode = readSD(buffer, &numBytes);
+        for (byte i = 0; i < numBytes; i++) {
+            loadByteToRAM(buffer[i]);
+        }
+    } while ((numBytes == SD_TRANSFER_SIZE) && !errCode);
+
+    return errCode;
+}
+
+byte BootManifestClass::load(const char* manifestName) {
+    BootSegment segments[BOOT_MANIFEST_MAX_SEGMENTS];
+    strcpy(this->_lastFileName, manifestName);
+    byte errCode = this->parse(manifestName, segments);
+    for (byte i = 0; (i < this->_numSegments) && !errCode; i++) {
+        errCode = this->loadSegment(&segments[i]);
+    }
+
+    setOsBank(this->_entryBank);
+    return errCode;
+}
+
+byte BootManifestClass::entryBank() {
+    return this->_entryBank;
+}
+
+word BootManifestClass::entryAddr() {
+    return this->_entryAddr;
+}
+
+const char* BootManifestClass::lastFileName() {
+    return this->_lastFileName;
+}
+
+BootManifestClass BootManifest;
@@ -0,0 +1,169 @@
+#include <EEPROM.h>
+#include "BootProfiler.h"
+#include "Uart.h"
+
+#define BOOT_REPORT_HDR_SIZE 2    // Record count + record size.
+#define NOT_PENDING 0xFF
+
+static_assert((BOOT_REPORT_HDR_SIZE + (BOOT_REPORT_RECORDS * sizeof(BootRecord))) <= 0xFF,
+    "Boot report must be readable with a single byte counter");
+
+BootProfilerClass::BootProfilerClass() {
+    memset(&this->record, 0, sizeof(BootRecord));
+    memset(this->calls, 0, sizeof(this->calls));
+    this->writeSlot = 0;
+    this->pendingOffset = NOT_PENDING;
+    this->finished = false;
+}
+
+void BootProfilerClass::begin(BootStep step) {
+    if (this->finished) {
+        // After boot (e.g. an SD mount by the Z80): the record is closed.
+        return;
+    }
+
+    // The accumulator briefly holds a negative start time. Unsigned wrap
+    // around makes the matching end() add up to the elapsed time.
+    this->record.stepUs[(byte)step] -= micros();
+}
+
+void BootProfilerClass::end(BootStep step) {
+    if (this->finished) {
+        return;
+    }
+
+    this->record.stepUs[(byte)step] += micros();
+    this->calls[(byte)step]++;
+}
+
+int BootProfilerClass::slotAddress(byte slot) {
+    return BOOT_REPORT_ADDR + (slot * sizeof(BootRecord));
+}
+
+void BootProfilerClass::findNewestSlot() {
+    word newestSeq = 0;
+    bool found = false;
+    this->writeSlot = 0;
+    for (byte slot = 0; slot < BOOT_REPORT_RECORDS; slot++) {
+        word seq;
+        EEPROM.get(this->slotAddress(slot), seq);
+        if ((seq != BOOT_REPORT_NO_SEQ) && (!found || (seq > newestSeq))) {
+            newestSeq = seq;
+            this->writeSlot = (slot + 1) % BOOT_REPORT_RECORDS;
+            found = true;
+        }
+    }
+
+    this->record.seq = found ? newestSeq + 1 : 0;
+    if (this->record.seq == BOOT_REPORT_NO_SEQ) {
+        this->record.seq = 0;
+    }
+}
+
+void BootProfilerClass::printStepName(byte step) {
+    switch ((BootStep)step) {
+        case BootStep::STAGE0:
+            Uart.print(F("Stage 0      "));
+            break;
+        case BootStep::RUN_TRIGGER:
+            Uart.print(F(" RUN trigger "));
+            break;
+        case BootStep::STAGE1:
+            Uart.print(F("Stage 1      "));
+            break;
+        case BootStep::STAGE2:
+            Uart.print(F("Stage 2      "));
+            break;
+        case BootStep::STAGE3:
+            Uart.print(F("Stage 3      "));
+            break;
+        case BootStep::I2C_PROBE:
+            Uart.print(F(" I2C probes  "));
+            break;
+        case BootStep::STAGE4:
+            Uart.print(F("Stage 4      "));
+            break;
+        case BootStep::BOOT_MENU:
+            Uart.print(F(" Boot menu   "));
+            break;
+        case BootStep::SD_MOUNT:
+            Uart.print(F(" SD mount    "));
+            break;
+        case BootStep::IMAGE_LOAD:
+            Uart.print(F(" Image load  "));
+            break;
+        case BootStep::STAGE5:
+            Uart.print(F("Stage 5      "));
+            break;
+        case BootStep::JINGLE:
+            Uart.print(F(" Jingle      "));
+            break;
+        default:
+            break;
+    }
+}
+
+void BootProfilerClass::finish() {
+    this->finished = true;
+    this->record.totalUs = micros();
+    this->findNewestSlot();
+
+    #ifdef DEBUG
+    Uart.print(F("DEBUG: Boot profile #"));
+    Uart.println(this->record.seq);
+    Uart.println(F("DEBUG: Step          Calls        us"));
+    for (byte i = 0; i < BOOT_STEP_COUNT; i++) {
+        Uart.print(F("DEBUG: "));
+        this->printStepName(i);
+        Uart.print(F("  "));
+        Uart.print(this->calls[i]);
+        Uart.print(F("  "));
+        Uart.println(this->record.stepUs[i]);
+    }
+
+    Uart.print(F("DEBUG: Total (us)         "));
+    Uart.println(this->record.totalUs);
+    #endif
+
+    this->pendingOffset = 0;
+}
+
+void BootProfilerClass::service() {
+    if ((this->pendingOffset == NOT_PENDING) || !eeprom_is_ready()) {
+        return;
+    }
+
+    const byte* data = (const byte*)&this->record;
+    EEPROM.update(this->slotAddress(this->writeSlot) + this->pendingOffset, data[this->pendingOffset]);
+    this->pendingOffset++;
+    if (this->pendingOffset >= sizeof(BootRecord)) {
+        this->pendingOffset = NOT_PENDING;
+    }
+}
+
+byte BootProfilerClass::reportSize() {
+    return BOOT_REPORT_HDR_SIZE + (BOOT_REPORT_RECORDS * sizeof(BootRecord));
+}
+
+byte BootProfilerClass::reportByte(byte index) {
+    if (index == 0) {
+        return BOOT_REPORT_RECORDS;
+    }
+
+    if (index == 1) {
+        return sizeof(BootRecord);
+    }
+
+    index -= BOOT_REPORT_HDR_SIZE;
+    byte age = index / sizeof(BootRecord);
+    byte offset = index % sizeof(BootRecord);
+    if (age == 0) {
+        // The current boot, which may not be fully stored yet.
+        return ((const byte*)&this->record)[offset];
+    }
+
+    byte slot = (this->writeSlot + BOOT_REPORT_RECORDS - age) % BOOT_REPORT_RECORDS;
+    return EEPROM.read(this->slotAddress(slot) + offset);
+}
+
+BootProfilerClass BootProfiler;
@@ -1,6 +1,8 @@
-#include <Wire.h>
 #include "BusControl.h"
 #include "hal.h"
+#include "TwiBus.h"
+#include "Uart.h"
+#include "IoDispatch.h"
 
 // BUSCTRL pin mappings
 #define PIN_CPRES_1 GPA0
@@ -10,169 +12,266 @@
 #define PIN_CEN_2 GPA4
 #define PIN_CEN_3 GPA5
 
-BusControlClass::BusControlClass() {
-    this->_hasBUSCTRL = false;
-    this->_hasIOXEP = false;
+// CPRES lines (and the unused GPA6-7) are inputs, CEN lines outputs.
+#define BUSCTLR_IODIRA ((byte)~((1 << PIN_CEN_1) | (1 << PIN_CEN_2) | (1 << PIN_CEN_3)))
+
+BusControlClass::BusControlClass() : _ioExp(GPIOEXP_ADDR), _busCtlr(BUSCTLR_ADDR) {
     this->_card1Present = false;
     this->_card2Present = false;
     this->_card3Present = false;
+    this->_pendingSlots = 0;
+    this->_cardPollTime = 0;
+    this->_watchMask = 0;
+    this->_inputs = 0;
+    this->_sampleTime = 0;
 }
 
 void BusControlClass::init() {
-    Wire.beginTransmission(GPIOEXP_ADDR);
-    this->_hasIOXEP = (Wire.endTransmission() == 0);
+    this->_ioExp.begin();
+
     #ifdef DEBUG
-    if (this->_hasIOXEP) {
-        Serial.println(F("INIT: boot3 - IOS: Found I/O Expander."));
+    if (this->_ioExp.isPresent()) {
+        Uart.println(F("INIT: boot3 - IOS: Found I/O Expander."));
     }
     #endif
 
-    this->_hasBUSCTRL = this->_busctlr.begin_I2C(BUSCTLR_ADDR);
-    if (this->_hasBUSCTRL) {
+    if (this->_busCtlr.begin()) {
         #ifdef DEBUG
-        Serial.println(F("INIT: boot3 - IOS: Found bus controller"));
-        Serial.print(F("INIT: boot3 - IOS: Initializing bus controller ..."));
+        Uart.println(F("INIT: boot3 - IOS: Found bus controller"));
+        Uart.print(F("INIT: boot3 - IOS: Initializing bus controller ..."));
         #endif
 
-        this->_busctlr.pinMode(PIN_CPRES_1, INPUT);
-        this->_busctlr.pinMode(PIN_CPRES_2, INPUT);
-        this->_busctlr.pinMode(PIN_CPRES_3, INPUT);
-        this->_busctlr.pinMode(PIN_CEN_1, OUTPUT);
-        this->_busctlr.digitalWrite(PIN_CEN_1, LOW);
-        this->_busctlr.pinMode(PIN_CEN_2, OUTPUT);
-        this->_busctlr.digitalWrite(PIN_CEN_2, LOW);
-        this->_busctlr.pinMode(PIN_CEN_3, OUTPUT);
-        this->_busctlr.digitalWrite(PIN_CEN_3, LOW);
+        // All cards disabled: the latch is set before the CEN lines become outputs.
+        TwiBus.beginBatch();
+        this->_busCtlr.writePort(GPIO_PORT_A, 0);
+        this->_busCtlr.setDirection(GPIO_PORT_A, BUSCTLR_IODIRA);
+        TwiBus.endBatch();
 
         #ifdef DEBUG
-        Serial.println(F("DONE"));
+        Uart.println(F("DONE"));
         #endif
     }
 }
 
 bool BusControlClass::hasIOEXP() {
-    return this->_hasIOXEP;
+    return this->_ioExp.isPresent();
 }
 
 bool BusControlClass::hasBUSCTLR() {
-    return this->_hasBUSCTRL;
+    return this->_busCtlr.isPresent();
 }
 
 void BusControlClass::writeGPIOA(byte data) {
-    if (!this->_hasIOXEP) {
-        return;
-    }
-
-    Wire.beginTransmission(GPIOEXP_ADDR);
-	Wire.write(GPIOA_REG);
-	Wire.write(data);
-	Wire.endTransmission();
+    this->_ioExp.writePort(GPIO_PORT_A, data);
 }
 
 void BusControlClass::writeGPIOB(byte data) {
-    if (!this->_hasIOXEP) {
-        return;
-    }
-
-    Wire.beginTransmission(GPIOEXP_ADDR);
-	Wire.write(GPIOB_REG);
-	Wire.write(data);
-	Wire.endTransmission();
+    this->_ioExp.writePort(GPIO_PORT_B, data);
 }
 
 void BusControlClass::writeIODirA(byte data) {
-    if (!this->_hasIOXEP) {
-        return;
-    }
-
-    Wire.beginTransmission(GPIOEXP_ADDR);
-	Wire.write(IODIRA_REG);
-	Wire.write(data);
-	Wire.endTransmission();
+    this->_ioExp.setDirection(GPIO_PORT_A, data);
 }
 
 void BusControlClass::writeIODirB(byte data) {
-    if (!this->_hasIOXEP) {
-        return;
+    this->_ioExp.setDirection(GPIO_PORT_B, data);
+}
+
+void BusControlClass::writeGPPUA(byte data) {
+    this->_ioExp.setPullups(GPIO_PORT_A, data);
+}
+
+void BusControlClass::writeGPPUB(byte data) {
+    this->_ioExp.setPullups(GPIO_PORT_B, data);
+}
+
+byte BusControlClass::readGPIOA() {
+    if (this->_watchMask) {
+        return lowByte(this->sampledGPIO());
     }
 
-    Wire.beginTransmission(GPIOEXP_ADDR);
-	Wire.write(IODIRB_REG);
-	Wire.write(data);
-	Wire.endTransmission();
+    return this->_ioExp.readPort(GPIO_PORT_A);
 }
 
-void BusControlClass::writeGPPUA(byte data) {
-    if (!this->_hasIOXEP) {
-        return;
+byte BusControlClass::readGPIOB() {
+    if (this->_watchMask) {
+        return highByte(this->sampledGPIO());
     }
 
-    Wire.beginTransmission(GPIOEXP_ADDR);
-	Wire.write(GPPUA_REG);
-    Wire.write(data);
-	Wire.endTransmission();
+    return this->_ioExp.readPort(GPIO_PORT_B);
 }
 
-void BusControlClass::writeGPPUB(byte data) {
-    if (!this->_hasIOXEP) {
-        return;
+void BusControlClass::writeGPIOAB(word data) {
+    this->_ioExp.writePorts(data);
+}
+
+void BusControlClass::setGPIOBits(byte port, byte mask) {
+    this->_ioExp.setBits(port, mask);
+}
+
+void BusControlClass::clearGPIOBits(byte port, byte mask) {
+    this->_ioExp.clearBits(port, mask);
+}
+
+void BusControlClass::toggleGPIOBits(byte port, byte mask) {
+    this->_ioExp.toggleBits(port, mask);
+}
+
+word BusControlClass::readGPIOAB() {
+    if (this->_watchMask) {
+        return this->sampledGPIO();
     }
 
-    Wire.beginTransmission(GPIOEXP_ADDR);
-	Wire.write(GPPUB_REG);
-	Wire.write(data);
-	Wire.endTransmission();
+    return this->_ioExp.readPorts();
 }
 
-byte BusControlClass::readGPIOA() {
-    if (!this->_hasIOXEP) {
-        return 0;
+void BusControlClass::setInputWatch(word mask) {
+    if (!this->_ioExp.isPresent()) {
+        return;
     }
 
-    Wire.beginTransmission(GPIOEXP_ADDR);
-	Wire.write(GPIOA_REG);
-	Wire.endTransmission();
+    if (mask && !this->_watchMask) {
+        // Start from the current state, so enabling doesn't report a change.
+        this->_inputs = this->_ioExp.readPorts();
+        this->_sampleTime = micros();
+    }
 
-	Wire.beginTransmission(GPIOEXP_ADDR);
-	Wire.requestFrom(GPIOEXP_ADDR, 1);
-    return Wire.read();
+    this->_watchMask = mask;
 }
 
-byte BusControlClass::readGPIOB() {
-    if (!this->_hasIOXEP) {
-        return 0;
+word BusControlClass::inputWatch() {
+    return this->_watchMask;
+}
+
+bool BusControlClass::sampleInputs() {
+    if (!this->_watchMask || ((micros() - this->_sampleTime) < GPIO_SAMPLE_US)) {
+        return false;
     }
 
-    Wire.beginTransmission(GPIOEXP_ADDR);
-	Wire.write(GPIOB_REG);
-	Wire.endTransmission();
+    this->_sampleTime = micros();
+    word inputs = this->_ioExp.readPorts();
+    word changed = (inputs ^ this->_inputs) & this->_watchMask;
+    this->_inputs = inputs;
+    return changed != 0;
+}
 
-	Wire.beginTransmission(GPIOEXP_ADDR);
-	Wire.requestFrom(GPIOEXP_ADDR, 1);
-    return Wire.read();
+word BusControlClass::sampledGPIO() {
+    // Inputs from the last sample, outputs from the latch (always current).
+    word inputs = this->_ioExp.directions();
+    return (this->_inputs & inputs) | (this->_ioExp.latches() & ~inputs);
 }
 
 void BusControlClass::detectCards() {
     // TODO Probably worth adding methods to inidividually enable/disable each card if present.
     // I can see the utility in having opcodes for doing this in software or even the ability
     // to do this in firmware under the right conditions (ie. disable card if faulted or to reset).
+    this->readSlots(&this->_pendingSlots);
+    this->applySlots(this->_pendingSlots);
+}
 
-    // TODO The general idea here is that each card slot have access to 16 I/O ports per slot,
-    // then gate access to those ports based on whether the card is present and enabled.
-    this->_card1Present = (this->_busctlr.digitalRead(PIN_CPRES_1) == HIGH);
-    if (this->_card1Present) {
-        this->_busctlr.digitalWrite(PIN_CEN_1, HIGH);
+bool BusControlClass::pollCards() {
+    if (!this->_busCtlr.isPresent() || ((millis() - this->_cardPollTime) < CARD_POLL_MS)) {
+        return false;
     }
 
-    this->_card2Present = (this->_busctlr.digitalRead(PIN_CPRES_2) == HIGH);
-    if (this->_card2Present) {
-        this->_busctlr.digitalWrite(PIN_CEN_2, HIGH);
+    this->_cardPollTime = millis();
+    byte slots;
+    if (!this->readSlots(&slots)) {
+        // A failed read says nothing about the cards (and reads as 0, "no
+        // cards"): skip this poll.
+        return false;
     }
 
-    this->_card3Present = (this->_busctlr.digitalRead(PIN_CPRES_3) == HIGH);
-    if (this->_card3Present) {
-        this->_busctlr.digitalWrite(PIN_CEN_3, HIGH);
+    if ((slots == this->slotMask()) || (slots != this->_pendingSlots)) {
+        // No change, or a new one: it must be seen on two polls in a row
+        // (contact bounce while a card is inserted).
+        this->_pendingSlots = slots;
+        return false;
     }
+
+    this->applySlots(slots);
+    return true;
+}
+
+byte BusControlClass::slotMask() {
+    return (this->_card1Present ? 0x01 : 0) | (this->_card2Present ? 0x02 : 0) | (this->_card3Present ? 0x04 : 0);
+}
+
+byte BusControlClass::findCardSlot(byte addr) {
+    byte slots = this->slotMask();
+    if (!slots || !TwiBus.probe(addr)) {
+        return IO_SLOT_NONE;
+    }
+
+    byte found = this->onlyCardSlot();
+    if (found != IO_SLOT_NONE) {
+        return found;
+    }
+
+    for (byte slot = 0; slot < IO_SLOT_COUNT; slot++) {
+        if (!bitRead(slots, slot)) {
+            continue;
+        }
+
+        this->writeEnables(slots & ~(1 << slot));
+        bool answered = TwiBus.probe(addr);
+        this->writeEnables(slots);
+        if (!answered) {
+            found = slot;
+            break;
+        }
+    }
+
+    return found;
+}
+
+byte BusControlClass::onlyCardSlot() {
+    byte slots = this->slotMask();
+    for (byte slot = 0; slot < IO_SLOT_COUNT; slot++) {
+        if (slots == (1 << slot)) {
+            return slot;
+        }
+    }
+
+    return IO_SLOT_NONE;
+}
+
+bool BusControlClass::readSlots(byte* slots) {
+    // All the CPRES lines in one port read.
+    byte cpres;
+    bool ok = this->_busCtlr.readPort(GPIO_PORT_A, &cpres);
+    *slots = bitRead(cpres, PIN_CPRES_1) | (bitRead(cpres, PIN_CPRES_2) << 1) | (bitRead(cpres, PIN_CPRES_3) << 2);
+    return ok;
+}
+
+void BusControlClass::applySlots(byte slots) {
+    this->_card1Present = bitRead(slots, 0);
+    this->_card2Present = bitRead(slots, 1);
+    this->_card3Present = bitRead(slots, 2);
+    this->writeCardEnables();
+}
+
+void BusControlClass::restoreCards(bool card1, bool card2, bool card3) {
+    // Same as detectCards(), but trusts the presence flags from the hardware
+    // profile instead of reading the CPRES lines.
+    this->_card1Present = card1;
+    this->_card2Present = card2;
+    this->_card3Present = card3;
+    this->_pendingSlots = this->slotMask();
+    this->writeCardEnables();
+}
+
+void BusControlClass::writeCardEnables() {
+    // Present cards are enabled.
+    this->writeEnables(this->slotMask());
+}
+
+void BusControlClass::writeEnables(byte slots) {
+    byte cen = lowByte(this->_busCtlr.latches());
+    bitWrite(cen, PIN_CEN_1, bitRead(slots, 0));
+    bitWrite(cen, PIN_CEN_2, bitRead(slots, 1));
+    bitWrite(cen, PIN_CEN_3, bitRead(slots, 2));
+    this->_busCtlr.writePort(GPIO_PORT_A, cen);
 }
 
 bool BusControlClass::card1Present() {
@@ -1,108 +1,128 @@
-#include <Wire.h>
 #include "hal.h"
+#include "TwiBus.h"
 #include "CyBorgSPP.h"
 
-CyBorgSPPClass::CyBorgSPPClass() {
-    this->_isPresent = false;
+#define SPOOL_MASK (SPP_SPOOL_SIZE - 1)
+
+// GPIOA status lines (inputs).
+#define SPP_BUSY 0b01000000
+#define SPP_ACK 0b10000000
+
+// IOCON.SEQOP: the register pointer doesn't increment, it toggles between
+// GPIOA and GPIOB, so one transaction can hold data and STROBE writes.
+#define IOCON_SEQOP 0b00100000
+
+CyBorgSPPClass::CyBorgSPPClass() : _port(SPP_ADDR, true) {
     this->_sppAutoFd = 0;
+    this->_spoolStatus = false;
     this->_tempData = 0;
+    this->_spoolHead = 0;
+    this->_spoolTail = 0;
 }
 
 void CyBorgSPPClass::detect() {
-    Wire.beginTransmission(SPP_ADDR);
-    this->_isPresent = (Wire.endTransmission() == 0);
-    #ifdef DEBUG
-	if (this->_isPresent) {
-		Serial.println(F("INIT: boot3 - IOS: Found Standard Parallel Port card"));
-	}
-	#endif
+    this->_port.begin();
 }
 
 bool CyBorgSPPClass::isPresent() {
-    return this->_isPresent;
+    return this->_port.isPresent();
 }
 
 void CyBorgSPPClass::init(byte data) {
-    if (!this->_isPresent) {
+    if (!this->_port.isPresent()) {
         return;
     }
 
-    this->_sppAutoFd = (!data) & 0x01;  // Store the value of the AUTOFD Control Line (active Low))
+    this->_sppAutoFd = (~data) & 0x01;  // Store the value of the AUTOFD Control Line (active Low))
+    this->_spoolStatus = (data & 0b00000010) != 0;
+    this->_spoolHead = this->_spoolTail;
+
+    TwiBus.beginBatch();
+    this->_port.writeReg(IOCON_REG, IOCON_SEQOP);
 
 	// Set STROBE and INIT at 1, and AUTOFD = !D0
-    Wire.beginTransmission(SPP_ADDR);
-    Wire.write(GPIOA_REG);              // Select GPIOA
-    Wire.write(0b00000101 | (byte) (this->_sppAutoFd << 1)); // Write value
-    Wire.endTransmission();
+    // NOTE: The latches are written raw (sendByte() writes them in sequences), so every pulse goes out.
+    this->_port.writeReg(GPIOA_REG, 0b00000101 | (byte) (this->_sppAutoFd << 1));   // Write value
 
 	// Set the GPIO port to work as an SPP port (direction and pullup)
-    Wire.beginTransmission(SPP_ADDR);
-    Wire.write(IODIRA_REG);             // Select IODIRA
-    Wire.write(0b11111000);             // Write value (1 = input, 0 = ouput)
-    Wire.endTransmission();
-    Wire.beginTransmission(SPP_ADDR);
-    Wire.write(IODIRB_REG);             // Select IODIRB 
-    Wire.write(0b00000000);             // Write value (1 = input, 0 = ouput)
-    Wire.endTransmission();
-    Wire.beginTransmission(SPP_ADDR);
-    Wire.write(GPPUA_REG);              // Select GPPUA
-    Wire.write(0b11111111);             // Write value (1 = pullup enabled, 0 = pullup disabled)
-    Wire.endTransmission();
+    this->_port.setDirection(GPIO_PORT_A, 0b11111000);   // Write value (1 = input, 0 = ouput)
+    this->_port.setDirection(GPIO_PORT_B, 0b00000000);   // Write value (1 = input, 0 = ouput)
+    this->_port.setPullups(GPIO_PORT_A, 0b11111111);   // Write value (1 = pullup enabled, 0 = pullup disabled)
 
 	// Initialize the printer using a pulse on INIT
     // NOTE: The I2C protocol introduces delays greater than needed by the SPP, so no further delay is used here to generate the pulse
     this->_tempData = 0b00000001 | (byte) (this->_sppAutoFd << 1);  // Change INIT bit to active (Low)
-    Wire.beginTransmission(SPP_ADDR);
-    Wire.write(GPIOA_REG);              // Select GPIOA
-    Wire.write(this->_tempData);        // Set INIT bit to active (Low)
-    Wire.endTransmission();
+    this->_port.writeReg(GPIOA_REG, this->_tempData);   // Set INIT bit to active (Low)
 
     this->_tempData = this->_tempData | 0b00000100;   // Change INIT bit to not active (High)
-    Wire.beginTransmission(SPP_ADDR);
-    Wire.write(GPIOA_REG);              // Select GPIOA
-    Wire.write(this->_tempData);        // Set INIT bit to not active (High)
-    Wire.endTransmission();
+    this->_port.writeReg(GPIOA_REG, this->_tempData);   // Set INIT bit to not active (High)
+    TwiBus.endBatch();
 }
 
 void CyBorgSPPClass::write(byte data) {
-    if (!this->_isPresent) {
+    if (!this->_port.isPresent()) {
+        return;
+    }
+
+    byte next = (this->_spoolHead + 1) & SPOOL_MASK;
+    while (next == this->_spoolTail) {
+        // Spool full: print until there is room.
+        this->service();
+        if (!this->_port.isPresent()) {
+            // The card stopped answering.
+            return;
+        }
+    }
+
+    this->_spool[this->_spoolHead] = data;
+    this->_spoolHead = next;
+}
+
+void CyBorgSPPClass::service() {
+    if (!this->_port.isPresent() || (this->_spoolHead == this->_spoolTail)) {
+        return;
+    }
+
+    byte status = this->_port.readPort(GPIO_PORT_A);
+    if ((status & SPP_BUSY) || !(status & SPP_ACK)) {
         return;
     }
 
+    this->sendByte(this->_spool[this->_spoolTail]);
+    this->_spoolTail = (this->_spoolTail + 1) & SPOOL_MASK;
+}
+
+void CyBorgSPPClass::sendByte(byte data) {
+    // One transaction, starting at GPIOB and toggling GPIOB/GPIOA (IOCON.SEQOP):
+    // data, STROBE active (Low), data (hold), STROBE not active (High).
     // NOTE: The I2C protocol introduces delays greater than needed by the SPP, so no further delay is used here to generate the pulse
-    Wire.beginTransmission(SPP_ADDR);
-    Wire.write(GPIOB_REG);            // Select GPIOB
-    Wire.write(data);                 // Data on GPIOB
-    Wire.endTransmission();
-
-    this->_tempData = 0b11111100 | (byte) (this->_sppAutoFd << 1);  // Change STROBE bit to active (Low)
-    Wire.beginTransmission(SPP_ADDR);
-    Wire.write(GPIOA_REG);              // Select GPIOA
-    Wire.write(this->_tempData);        // Set STROBE bit to active (Low)
-    Wire.endTransmission();
-
-    this->_tempData = this->_tempData | 0b00000001;   // Change STROBE bit to not active (High)
-    Wire.beginTransmission(SPP_ADDR);
-    Wire.write(GPIOA_REG);              // Select GPIOA
-    Wire.write(this->_tempData);        // Set STROBE bit to not active (High)
-    Wire.endTransmission();
+    this->_tempData = 0b11111100 | (byte) (this->_sppAutoFd << 1);  // STROBE bit active (Low)
+    byte sequence[5] = {
+        GPIOB_REG,
+        data,
+        this->_tempData,
+        data,
+        (byte)(this->_tempData | 0b00000001)    // STROBE bit not active (High)
+    };
+
+    this->_port.writeSequence(sequence, sizeof(sequence));
 }
 
 byte CyBorgSPPClass::read() {
-    if (!this->_isPresent) {
+    if (!this->_port.isPresent()) {
         return 0;
     }
 
-    // Set MCP23017 pointer to GPIOA
-    Wire.beginTransmission(SPP_ADDR);
-    Wire.write(GPIOA_REG);
-    Wire.endTransmission();
-                
     // Read GPIOA (SPP Status Lines)
-    Wire.beginTransmission(SPP_ADDR);
-    Wire.requestFrom(SPP_ADDR, 1);
-    byte ioData = Wire.read();
-    ioData = (ioData & 0b11111000) | 0b00000001;      // Set D0 = 1, D1 = D2 = 0
+    byte ioData = this->_port.readPort(GPIO_PORT_A);
+    ioData = (ioData & 0b11111000) | 0b00000001;      // Set D0 = 1
+    if (this->_spoolStatus && (this->_spoolHead != this->_spoolTail)) {
+        ioData |= 0b00000010;                         // D1 = 1: spool not empty (printing)
+        if (((this->_spoolHead + 1) & SPOOL_MASK) == this->_spoolTail) {
+            ioData |= 0b00000100;                     // D2 = 1: spool full
+        }
+    }
+
     return ioData;
 }
 
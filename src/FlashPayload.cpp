@@ -0,0 +1,60 @@
+#include "FlashPayload.h"
+#include "hal.h"
+#include "iLoad.h"
+
+#define WINDOW_MASK (LZ_WINDOW_SIZE - 1)
+
+FlashPayloadClass::FlashPayloadClass() {
+}
+
+bool FlashPayloadClass::find(byte bootMode, ResidentPayload* payload) {
+    for (byte i = 0; i < (sizeof(flashBootTable) / sizeof(flashBootTable[0])); i++) {
+        if (pgm_read_byte(&flashBootTable[i].bootMode) == bootMode) {
+            memcpy_P(payload, &flashBootTable[i], sizeof(ResidentPayload));
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void FlashPayloadClass::inject(const ResidentPayload* payload) {
+    byte window[LZ_WINDOW_SIZE];
+    byte pos = 0;
+    byte flags = 0;
+    byte numFlags = 0;
+    const byte* src = payload->data;
+    word remaining = payload->rawSize;
+    while (remaining) {
+        if (!numFlags) {
+            flags = pgm_read_byte(src++);
+            numFlags = 8;
+        }
+
+        if (flags & 1) {
+            // Literal
+            byte value = pgm_read_byte(src++);
+            window[pos] = value;
+            pos = (pos + 1) & WINDOW_MASK;
+            loadByteToRAM(value);
+            remaining--;
+        }
+        else {
+            // Match: copy from 1..LZ_WINDOW_SIZE bytes back.
+            byte from = (pos - 1 - pgm_read_byte(src++)) & WINDOW_MASK;
+            word len = pgm_read_byte(src++) + LZ_MIN_MATCH;
+            for (; len && remaining; len--, remaining--) {
+                byte value = window[from];
+                from = (from + 1) & WINDOW_MASK;
+                window[pos] = value;
+                pos = (pos + 1) & WINDOW_MASK;
+                loadByteToRAM(value);
+            }
+        }
+
+        flags >>= 1;
+        numFlags--;
+    }
+}
+
+FlashPayloadClass FlashPayload;
@@ -0,0 +1,28 @@
+#include "HwProfile.h"
+
+#define WARM_BOOT_MAGIC 0xB007
+
+// Not cleared by the C runtime, so it keeps its value across an MCU reset.
+static word warmBootMarker __attribute__((section(".noinit")));
+static word warmBootCheck __attribute__((section(".noinit")));
+
+byte HwProfile::calcChecksum() {
+	const byte* data = (const byte*)this;
+	byte sum = 0;
+	for (byte i = 0; i < offsetof(HwProfile, checksum); i++) {
+		sum = (sum << 1 | sum >> 7) ^ data[i];
+	}
+
+	return ~sum;
+}
+
+bool HwProfile::isWarmBoot() {
+	return (warmBootMarker == WARM_BOOT_MAGIC) && (warmBootCheck == (word)~WARM_BOOT_MAGIC);
+}
+
+void HwProfile::markWarmBoot() {
+	warmBootMarker = WARM_BOOT_MAGIC;
+	warmBootCheck = (word)~WARM_BOOT_MAGIC;
+}
+
+HwProfile hwProfile_t;
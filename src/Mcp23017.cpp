@@ -0,0 +1,140 @@
+#include "Mcp23017.h"
+#include "TwiBus.h"
+
+Mcp23017::Mcp23017(byte addr, bool removable) {
+    this->_addr = addr;
+    this->_removable = removable;
+    this->_isPresent = false;
+
+    // Power-on reset values.
+    memset(this->_iodir, 0xFF, sizeof(this->_iodir));
+    memset(this->_gppu, 0, sizeof(this->_gppu));
+    memset(this->_olat, 0, sizeof(this->_olat));
+}
+
+bool Mcp23017::begin() {
+    this->_isPresent = TwiBus.probe(this->_addr);
+    if (this->_isPresent) {
+        TwiBus.setDeviceClock(this->_addr, TWI_FAST_FREQ);
+        TwiBus.readRegs(this->_addr, IODIRA_REG, this->_iodir, 2);
+        TwiBus.readRegs(this->_addr, GPPUA_REG, this->_gppu, 2);
+        TwiBus.readRegs(this->_addr, OLATA_REG, this->_olat, 2);
+    }
+
+    return this->_isPresent;
+}
+
+bool Mcp23017::isPresent() {
+    return this->_isPresent;
+}
+
+void Mcp23017::writePort(byte port, byte data) {
+    port &= GPIO_PORT_B;
+    this->writeShadowed(GPIOA_REG + port, &this->_olat[port], data);
+}
+
+void Mcp23017::writePorts(word data) {
+    if (!this->_isPresent || ((this->_olat[0] == lowByte(data)) && (this->_olat[1] == highByte(data)))) {
+        return;
+    }
+
+    // Sequential write: GPIOA, then GPIOB.
+    this->_olat[0] = lowByte(data);
+    this->_olat[1] = highByte(data);
+    byte sequence[3] = {GPIOA_REG, this->_olat[0], this->_olat[1]};
+    TwiBus.postBytes(this->_addr, sequence, sizeof(sequence));
+}
+
+void Mcp23017::setDirection(byte port, byte data) {
+    port &= GPIO_PORT_B;
+    this->writeShadowed(IODIRA_REG + port, &this->_iodir[port], data);
+}
+
+void Mcp23017::setPullups(byte port, byte data) {
+    port &= GPIO_PORT_B;
+    this->writeShadowed(GPPUA_REG + port, &this->_gppu[port], data);
+}
+
+void Mcp23017::setBits(byte port, byte mask) {
+    port &= GPIO_PORT_B;
+    this->writeShadowed(GPIOA_REG + port, &this->_olat[port], this->_olat[port] | mask);
+}
+
+void Mcp23017::clearBits(byte port, byte mask) {
+    port &= GPIO_PORT_B;
+    this->writeShadowed(GPIOA_REG + port, &this->_olat[port], this->_olat[port] & ~mask);
+}
+
+void Mcp23017::toggleBits(byte port, byte mask) {
+    port &= GPIO_PORT_B;
+    this->writeShadowed(GPIOA_REG + port, &this->_olat[port], this->_olat[port] ^ mask);
+}
+
+byte Mcp23017::readPort(byte port) {
+    byte data;
+    this->readPort(port, &data);
+    return data;
+}
+
+bool Mcp23017::readPort(byte port, byte* data) {
+    *data = 0;
+    if (!this->_isPresent) {
+        return false;
+    }
+
+    byte status = TwiBus.readRegs(this->_addr, GPIOA_REG + (port & GPIO_PORT_B), data, 1);
+    this->checkStatus(status);
+    return status == TWI_OK;
+}
+
+word Mcp23017::readPorts() {
+    if (!this->_isPresent) {
+        return 0;
+    }
+
+    // Sequential read: GPIOA, then GPIOB.
+    byte data[2] = {0, 0};
+    this->checkStatus(TwiBus.readRegs(this->_addr, GPIOA_REG, data, sizeof(data)));
+    return word(data[1], data[0]);
+}
+
+word Mcp23017::latches() {
+    return word(this->_olat[1], this->_olat[0]);
+}
+
+word Mcp23017::directions() {
+    return word(this->_iodir[1], this->_iodir[0]);
+}
+
+void Mcp23017::writeReg(byte reg, byte data) {
+    if (!this->_isPresent) {
+        return;
+    }
+
+    TwiBus.post(this->_addr, reg, data);
+}
+
+void Mcp23017::writeSequence(const byte* data, byte len) {
+    if (!this->_isPresent) {
+        return;
+    }
+
+    TwiBus.postBytes(this->_addr, data, len);
+}
+
+void Mcp23017::checkStatus(byte status) {
+    // A card chip that doesn't answer its address is gone: a pulled card. (A
+    // timeout may come from another device holding the bus, so it doesn't count.)
+    if (this->_removable && (status == TWI_ERR_ADDR_NACK)) {
+        this->_isPresent = false;
+    }
+}
+
+void Mcp23017::writeShadowed(byte reg, byte* shadow, byte data) {
+    if (!this->_isPresent || (*shadow == data)) {
+        return;
+    }
+
+    *shadow = data;
+    TwiBus.post(this->_addr, reg, data);
+}
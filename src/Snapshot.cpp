@@ -0,0 +1,126 @@
+#include "hal.h"
+#include "opcodes.h"
+#include "Snapshot.h"
+
+static const char SNAPSHOT_MAGIC[4] = {'C', 'Y', 'S', 'N'};
+
+static_assert(sizeof(SnapshotHeader) <= SD_TRANSFER_SIZE, "Snapshot header must fit in one SD transfer");
+
+SnapshotClass::SnapshotClass() {
+}
+
+byte SnapshotClass::open(FATFS* fatfs) {
+    byte errCode = openSD(SNAPSHOT_FN);
+    if (errCode) {
+        return errCode;
+    }
+
+    // PetitFS can't extend a file, so it must have been preallocated.
+    if (fatfs->fsize < SNAPSHOT_FILE_SIZE) {
+        return ERR_DSK_EMU_BAD_SNAPSHOT;
+    }
+
+    return ERR_DSK_EMU_OK;
+}
+
+void SnapshotClass::selectRegion(byte region) {
+    if (region < OS_MEM_BANK_2 + 1) {
+        // Lower half of the address space, banked.
+        setOsBank(region);
+        loadHL(ZERO_ADDR);
+    }
+    else {
+        // Upper half of the address space (common fixed bank).
+        loadHL(SNAPSHOT_REGION_SIZE);
+    }
+}
+
+byte SnapshotClass::save(FATFS* fatfs, SnapshotHeader* header) {
+    byte buffer[SD_TRANSFER_SIZE];
+    byte numBytes = 0;
+    byte errCode = this->open(fatfs);
+    if (!errCode) {
+        errCode = seekSD(SNAPSHOT_HDR_SECTORS);
+    }
+
+    for (byte region = 0; (region < SNAPSHOT_REGIONS) && !errCode; region++) {
+        this->selectRegion(region);
+        for (word chunk = 0; chunk < (SNAPSHOT_REGION_SIZE / SD_TRANSFER_SIZE); chunk++) {
+            for (byte i = 0; i < SD_TRANSFER_SIZE; i++) {
+                buffer[i] = readByteFromRAM();
+            }
+
+            errCode = writeSD(buffer, &numBytes);
+            if (!errCode && (numBytes < SD_TRANSFER_SIZE)) {
+                errCode = ERR_DSK_EMU_UNEXPECTED_EOF;
+            }
+
+            if (errCode) {
+                break;
+            }
+        }
+    }
+
+    // The header goes last, so an interrupted dump never looks valid.
+    if (!errCode) {
+        memcpy(header->magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+        header->version = SNAPSHOT_VERSION;
+        memset(buffer, 0, sizeof(buffer));
+        memcpy(buffer, header, sizeof(SnapshotHeader));
+        errCode = seekSD(0);
+        if (!errCode) {
+            errCode = writeSD(buffer, &numBytes);
+        }
+
+        if (!errCode) {
+            errCode = writeSD(NULL, &numBytes);
+        }
+    }
+
+    setOsBank(header->osBank);
+    return errCode;
+}
+
+byte SnapshotClass::load(FATFS* fatfs, SnapshotHeader* header) {
+    byte buffer[SD_TRANSFER_SIZE];
+    byte numBytes = 0;
+    byte errCode = this->open(fatfs);
+    if (!errCode) {
+        errCode = readSD(buffer, &numBytes);
+    }
+
+    if (errCode) {
+        return errCode;
+    }
+
+    memcpy(header, buffer, sizeof(SnapshotHeader));
+    if ((memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0)
+        || (header->version != SNAPSHOT_VERSION)
+        || (header->osBank > OS_MEM_BANK_2)) {
+        return ERR_DSK_EMU_BAD_SNAPSHOT;
+    }
+
+    errCode = seekSD(SNAPSHOT_HDR_SECTORS);
+    for (byte region = 0; (region < SNAPSHOT_REGIONS) && !errCode; region++) {
+        this->selectRegion(region);
+        for (word chunk = 0; chunk < (SNAPSHOT_REGION_SIZE / SD_TRANSFER_SIZE); chunk++) {
+            errCode = readSD(buffer, &numBytes);
+            if (!errCode && (numBytes < SD_TRANSFER_SIZE)) {
+                errCode = ERR_DSK_EMU_UNEXPECTED_EOF;
+            }
+
+            if (errCode) {
+                break;
+            }
+
+            for (byte i = 0; i < SD_TRANSFER_SIZE; i++) {
+                loadByteToRAM(buffer[i]);
+            }
+        }
+    }
+
+    setOsBank(header->osBank);
+    return errCode;
+}
+
+SnapshotClass Snapshot;
@@ -0,0 +1,391 @@
+#include "TwiBus.h"
+#include "FastPin.h"
+
+#define QUEUE_MASK (TWI_QUEUE_SIZE - 1)
+#define ENTRY_READ 0x80          // Header flag: read after the written bytes.
+#define ENTRY_REPSTART 0x40      // Header flag: follows the previous entry with a repeated START.
+#define ENTRY_LEN_MASK 0x3F
+
+// Queue entry: address, header (length and flags), TWBR, then the data.
+#define ENTRY_OVERHEAD 3
+
+#define TWBR_FOR(freq) ((byte)(((F_CPU / (freq)) - 16) / 2))
+
+// TWSR status codes (prescaler bits masked).
+#define TW_START 0x08
+#define TW_REP_START 0x10
+#define TW_MT_SLA_ACK 0x18
+#define TW_MT_SLA_NACK 0x20
+#define TW_MT_DATA_ACK 0x28
+#define TW_MT_DATA_NACK 0x30
+#define TW_ARB_LOST 0x38
+#define TW_MR_SLA_ACK 0x40
+#define TW_MR_SLA_NACK 0x48
+#define TW_MR_DATA_ACK 0x50
+#define TW_MR_DATA_NACK 0x58
+
+#define TWCR_NEXT ((1 << TWINT) | (1 << TWEN) | (1 << TWIE))
+
+// Bus recovery: half an SCL period at 100kHz, and the clocks that free any
+// slave stuck in the middle of a byte (8 data bits and the ACK).
+#define RECOVERY_HALF_BIT_US 5
+#define RECOVERY_CLOCKS 9
+
+static inline void saturatingInc(word& counter) __attribute__((always_inline));
+static inline void saturatingInc(word& counter) {
+    if (counter != 0xFFFF) {
+        counter++;
+    }
+}
+
+TwiBusClass::TwiBusClass() {
+    this->_devices = 0;
+    this->_pendingHead = 0;
+    this->_batching = false;
+    this->_batchStarted = false;
+    this->_head = 0;
+    this->_tail = 0;
+    this->_busy = false;
+    this->_stopWait = false;
+    this->_status = TWI_OK;
+    this->_txStart = 0;
+    memset(&this->_stats, 0, sizeof(TwiStats));
+    this->_addr = 0;
+    this->_txLeft = 0;
+    this->_readPending = false;
+    this->_reading = false;
+    this->_rxBuf = NULL;
+    this->_rxLeft = 0;
+}
+
+void TwiBusClass::begin() {
+    FastPin<PIN_SDA>::high();
+    FastPin<PIN_SCL>::high();
+    if (!FastPin<PIN_SDA>::read()) {
+        this->clockOut();
+    }
+
+    TWSR = 0;     // Prescaler 1
+    TWBR = TWBR_FOR(TWI_FREQ);
+    TWCR = (1 << TWEN);
+}
+
+bool TwiBusClass::probe(byte addr) {
+    return this->write(addr, NULL, 0) == TWI_OK;
+}
+
+void TwiBusClass::setDeviceClock(byte addr, unsigned long freq) {
+    byte twbr = TWBR_FOR(freq);
+    for (byte i = 0; i < this->_devices; i++) {
+        if (this->_deviceAddr[i] == addr) {
+            this->_deviceTwbr[i] = twbr;
+            return;
+        }
+    }
+
+    if (this->_devices < TWI_MAX_DEVICES) {
+        this->_deviceAddr[this->_devices] = addr;
+        this->_deviceTwbr[this->_devices] = twbr;
+        this->_devices++;
+    }
+}
+
+void TwiBusClass::beginBatch() {
+    this->_batching = true;
+    this->_batchStarted = false;
+}
+
+void TwiBusClass::endBatch() {
+    this->_batching = false;
+    this->publish();
+}
+
+void TwiBusClass::post(byte addr, byte reg, byte data) {
+    byte buffer[2] = {reg, data};
+    this->enqueue(addr, 2, buffer, 2);
+}
+
+void TwiBusClass::postBytes(byte addr, const byte* data, byte len) {
+    this->enqueue(addr, len, data, len);
+}
+
+byte TwiBusClass::write(byte addr, const byte* data, byte len) {
+    this->enqueue(addr, len, data, len);
+    this->flush();
+    return this->_status;
+}
+
+byte TwiBusClass::readRegs(byte addr, byte reg, byte* data, byte len) {
+    this->flush();
+    this->_rxBuf = data;
+    this->_rxLeft = len;
+    this->enqueue(addr, 1 | ENTRY_READ, &reg, 1);
+    this->flush();
+    if (this->_status != TWI_OK) {
+        memset(data, 0, len);
+    }
+
+    return this->_status;
+}
+
+void TwiBusClass::flush() {
+    this->publish();
+    while (this->_busy && !this->checkTimeout());
+}
+
+void TwiBusClass::service() {
+    if (this->_busy) {
+        this->checkTimeout();
+    }
+}
+
+TwiStats TwiBusClass::stats() {
+    uint8_t oldSREG = SREG;
+    cli();
+    TwiStats copy = this->_stats;
+    SREG = oldSREG;
+    return copy;
+}
+
+byte TwiBusClass::deviceTwbr(byte addr) {
+    for (byte i = 0; i < this->_devices; i++) {
+        if (this->_deviceAddr[i] == addr) {
+            return this->_deviceTwbr[i];
+        }
+    }
+
+    return TWBR_FOR(TWI_FREQ);
+}
+
+void TwiBusClass::enqueue(byte addr, byte header, const byte* data, byte len) {
+    // Wait for room. An open batch that fills the queue is sent as it is.
+    while ((byte)(TWI_QUEUE_SIZE - 1 - ((byte)(this->_pendingHead - this->_tail) & QUEUE_MASK)) < (byte)(len + ENTRY_OVERHEAD)) {
+        this->publish();
+        this->checkTimeout();
+    }
+
+    if (this->_batching) {
+        if (this->_batchStarted) {
+            header |= ENTRY_REPSTART;
+        }
+
+        this->_batchStarted = true;
+    }
+
+    byte head = this->_pendingHead;
+    this->_queue[head] = addr;
+    head = (head + 1) & QUEUE_MASK;
+    this->_queue[head] = header;
+    head = (head + 1) & QUEUE_MASK;
+    this->_queue[head] = this->deviceTwbr(addr);
+    head = (head + 1) & QUEUE_MASK;
+    for (byte i = 0; i < len; i++) {
+        this->_queue[head] = data[i];
+        head = (head + 1) & QUEUE_MASK;
+    }
+
+    this->_pendingHead = head;
+    if (!this->_batching) {
+        this->publish();
+    }
+}
+
+void TwiBusClass::publish() {
+    uint8_t oldSREG = SREG;
+    cli();
+    this->_head = this->_pendingHead;
+    if (!this->_busy && (this->_head != this->_tail)) {
+        this->_busy = true;
+        if (TWCR & (1 << TWSTO)) {
+            // The last STOP must be out before the next START. Don't wait
+            // for it here: checkTimeout() starts the transaction once it is
+            // out (a slave holding SCL low keeps it from going out).
+            this->_stopWait = true;
+            this->_txStart = micros();
+        }
+        else {
+            this->startNext(false);
+        }
+    }
+
+    SREG = oldSREG;
+}
+
+bool TwiBusClass::checkTimeout() {
+    uint8_t oldSREG = SREG;
+    cli();
+    if (this->_stopWait && !(TWCR & (1 << TWSTO))) {
+        this->_stopWait = false;
+        this->startNext(false);
+    }
+
+    bool timedOut = this->_busy && ((micros() - this->_txStart) >= TWI_TIMEOUT_US);
+    if (timedOut) {
+        this->recover();
+    }
+
+    SREG = oldSREG;
+    if (timedOut) {
+        // The recovery clocks take ~100us, longer than a byte at the fast
+        // UART rates, so they run with interrupts on. The TWI is off, so
+        // its interrupt can't fire meanwhile.
+        this->clockOut();
+        TWCR = (1 << TWEN);
+    }
+
+    return timedOut;
+}
+
+void TwiBusClass::recover() {
+    // Called with interrupts off. The TWI lets go of the pins when disabled;
+    // the caller then frees the bus (clockOut()) and enables it again.
+    TWCR = 0;
+
+    // Drop the transaction and all the queued ones (open batch included):
+    // they would most likely fail the same way.
+    this->_tail = this->_pendingHead;
+    this->_head = this->_pendingHead;
+    this->_txLeft = 0;
+    this->_readPending = false;
+    this->_reading = false;
+    this->_rxLeft = 0;
+    this->_busy = false;
+    this->_stopWait = false;
+    this->_status = TWI_ERR_TIMEOUT;
+    this->countError(TWI_ERR_TIMEOUT);
+    saturatingInc(this->_stats.timeouts);
+}
+
+void TwiBusClass::clockOut() {
+    // SCL is driven as an open drain output (low or released with the
+    // pullup) and clocked until the slave releases SDA, then a STOP (SDA
+    // rising while SCL is high) resets the slaves.
+    FastPin<PIN_SDA>::input();
+    FastPin<PIN_SDA>::high();
+    for (byte i = 0; (i < RECOVERY_CLOCKS) && !FastPin<PIN_SDA>::read(); i++) {
+        FastPin<PIN_SCL>::low();
+        FastPin<PIN_SCL>::output();
+        delayMicroseconds(RECOVERY_HALF_BIT_US);
+        FastPin<PIN_SCL>::input();
+        FastPin<PIN_SCL>::high();
+        delayMicroseconds(RECOVERY_HALF_BIT_US);
+    }
+
+    FastPin<PIN_SCL>::low();
+    FastPin<PIN_SCL>::output();
+    FastPin<PIN_SDA>::low();
+    FastPin<PIN_SDA>::output();
+    delayMicroseconds(RECOVERY_HALF_BIT_US);
+    FastPin<PIN_SCL>::input();
+    FastPin<PIN_SCL>::high();
+    delayMicroseconds(RECOVERY_HALF_BIT_US);
+    FastPin<PIN_SDA>::input();
+    FastPin<PIN_SDA>::high();
+    delayMicroseconds(RECOVERY_HALF_BIT_US);
+}
+
+void TwiBusClass::startNext(bool stop) {
+    if (this->_head == this->_tail) {
+        this->_busy = false;
+        TWCR = (1 << TWINT) | (1 << TWEN) | (1 << TWSTO);
+        return;
+    }
+
+    byte tail = this->_tail;
+    this->_addr = this->_queue[tail];
+    tail = (tail + 1) & QUEUE_MASK;
+    byte header = this->_queue[tail];
+    tail = (tail + 1) & QUEUE_MASK;
+    TWBR = this->_queue[tail];
+    this->_tail = (tail + 1) & QUEUE_MASK;
+    this->_txLeft = header & ENTRY_LEN_MASK;
+    this->_readPending = (header & ENTRY_READ) != 0;
+    this->_reading = false;
+    this->_txStart = micros();
+
+    // STOP + START in one go when a transaction was running, unless this
+    // entry continues a batch (repeated START).
+    if (header & ENTRY_REPSTART) {
+        stop = false;
+    }
+
+    TWCR = TWCR_NEXT | (1 << TWSTA) | (stop ? (1 << TWSTO) : 0);
+}
+
+void TwiBusClass::endTransaction(byte status) {
+    // Drop what is left of a failed transaction.
+    this->_tail = (this->_tail + this->_txLeft) & QUEUE_MASK;
+    this->_txLeft = 0;
+    this->_readPending = false;
+    this->_reading = false;
+    this->_status = status;
+    if (status != TWI_OK) {
+        this->countError(status);
+    }
+
+    this->startNext(true);
+}
+
+void TwiBusClass::countError(byte status) {
+    saturatingInc(this->_stats.errors);
+    this->_stats.lastError = status;
+}
+
+inline void TwiBusClass::irq() {
+    switch (TWSR & 0xF8) {
+        case TW_START:
+        case TW_REP_START:
+            TWDR = (this->_addr << 1) | (this->_reading ? 1 : 0);
+            TWCR = TWCR_NEXT;
+            break;
+        case TW_MT_SLA_ACK:
+        case TW_MT_DATA_ACK:
+            if (this->_txLeft) {
+                TWDR = this->_queue[this->_tail];
+                this->_tail = (this->_tail + 1) & QUEUE_MASK;
+                this->_txLeft--;
+                TWCR = TWCR_NEXT;
+            }
+            else if (this->_readPending) {
+                this->_readPending = false;
+                this->_reading = true;
+                TWCR = TWCR_NEXT | (1 << TWSTA);
+            }
+            else {
+                this->endTransaction(TWI_OK);
+            }
+            break;
+        case TW_MT_SLA_NACK:
+        case TW_MR_SLA_NACK:
+            this->endTransaction(TWI_ERR_ADDR_NACK);
+            break;
+        case TW_MT_DATA_NACK:
+            this->endTransaction(TWI_ERR_DATA_NACK);
+            break;
+        case TW_MR_SLA_ACK:
+            // ACK all the bytes but the last one.
+            TWCR = TWCR_NEXT | ((this->_rxLeft > 1) ? (1 << TWEA) : 0);
+            break;
+        case TW_MR_DATA_ACK:
+            *this->_rxBuf++ = TWDR;
+            this->_rxLeft--;
+            TWCR = TWCR_NEXT | ((this->_rxLeft > 1) ? (1 << TWEA) : 0);
+            break;
+        case TW_MR_DATA_NACK:
+            *this->_rxBuf++ = TWDR;
+            this->_rxLeft = 0;
+            this->endTransaction(TWI_OK);
+            break;
+        case TW_ARB_LOST:
+        default:
+            // Bus error: the STOP sent by startNext() releases the bus.
+            this->endTransaction(TWI_ERR_BUS);
+            break;
+    }
+}
+
+ISR(TWI_vect) {
+    TwiBus.irq();
+}
+
+TwiBusClass TwiBus;
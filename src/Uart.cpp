@@ -0,0 +1,291 @@
+#include "Uart.h"
+#include "FastPin.h"
+
+#define RX_MASK (UART_RX_BUFFER_SIZE - 1)
+#define TX_MASK (UART_TX_BUFFER_SIZE - 1)
+
+// RTS is deasserted (HIGH) when the RX ring has less free room than this.
+#define RTS_THRESHOLD (UART_RX_BUFFER_SIZE / 4)
+
+static inline void saturatingInc(word& counter) __attribute__((always_inline));
+static inline void saturatingInc(word& counter) {
+    if (counter != 0xFFFF) {
+        counter++;
+    }
+}
+
+UartClass::UartClass() {
+    this->_rxHead = 0;
+    this->_rxTail = 0;
+    this->_txHead = 0;
+    this->_txTail = 0;
+    this->_txStarted = false;
+    this->_txHeld = false;
+    this->_txBarrier = 0;
+    this->_switchUbrr = 0;
+    this->_switchLead = 0;
+    this->_received = false;
+    memset(&this->_stats, 0, sizeof(UartStats));
+}
+
+void UartClass::begin(unsigned long baud) {
+    #ifdef UART_FLOW_CONTROL
+    FastPin<UART_PIN_RTS>::low();
+    FastPin<UART_PIN_RTS>::output();
+    FastPin<UART_PIN_CTS>::input();
+    #endif
+
+    this->setUbrr(ubrrFor(baud));
+    UCSRC = (1 << URSEL) | (1 << UCSZ1) | (1 << UCSZ0);    // 8N1
+    UCSRB = (1 << RXEN) | (1 << TXEN) | (1 << RXCIE);
+}
+
+word UartClass::ubrrFor(unsigned long baud) {
+    // Double speed mode: half the rounding error of the normal mode at the
+    // standard rates.
+    return ((F_CPU / 8) + (baud / 2)) / baud - 1;
+}
+
+void UartClass::setUbrr(word ubrr) {
+    UCSRA = (1 << U2X);
+    UBRRH = highByte(ubrr) & 0x0F;
+    UBRRL = lowByte(ubrr);
+}
+
+void UartClass::end() {
+    this->flush();
+    UCSRB = 0;
+    this->_rxHead = this->_rxTail;
+}
+
+int UartClass::available() {
+    return (byte)(this->_rxHead - this->_rxTail) & RX_MASK;
+}
+
+int UartClass::peek() {
+    if (this->_rxHead == this->_rxTail) {
+        return -1;
+    }
+
+    return this->_rxBuffer[this->_rxTail];
+}
+
+int UartClass::read() {
+    if (this->_rxHead == this->_rxTail) {
+        return -1;
+    }
+
+    byte data = this->_rxBuffer[this->_rxTail];
+    this->_rxTail = (this->_rxTail + 1) & RX_MASK;
+    this->updateRts();
+    return data;
+}
+
+int UartClass::availableForWrite() {
+    // One slot is kept empty to tell a full ring from an empty one.
+    return TX_MASK - ((byte)(this->_txHead - this->_txTail) & TX_MASK);
+}
+
+bool UartClass::isTxFull() {
+    return ((this->_txHead + 1) & TX_MASK) == this->_txTail;
+}
+
+bool UartClass::tryWrite(byte data) {
+    byte next = (this->_txHead + 1) & TX_MASK;
+    if (next == this->_txTail) {
+        return false;
+    }
+
+    this->_txBuffer[this->_txHead] = data;
+    this->_txHead = next;
+    UCSRB |= (1 << UDRIE);
+    return true;
+}
+
+size_t UartClass::write(uint8_t data) {
+    if (!this->tryWrite(data)) {
+        uint8_t oldSREG = SREG;
+        cli();
+        saturatingInc(this->_stats.txStalls);
+        SREG = oldSREG;
+
+        while (!this->tryWrite(data)) {
+            this->pollTx();
+            this->service();
+        }
+    }
+
+    return 1;
+}
+
+void UartClass::flush() {
+    while (this->_txHeld || (this->_txHead != this->_txTail) || (UCSRB & (1 << UDRIE))) {
+        this->pollTx();
+        this->service();
+    }
+
+    // Wait for the last byte to leave the shift register.
+    while (this->_txStarted && !(UCSRA & (1 << TXC)));
+}
+
+void UartClass::service() {
+    #ifdef UART_FLOW_CONTROL
+    if ((this->_txHead != this->_txTail) && !FastPin<UART_PIN_CTS>::read()) {
+        UCSRB |= (1 << UDRIE);
+    }
+    #endif
+}
+
+void UartClass::pollTx() {
+    // Interrupts may be off (called from an ISR): move a byte out by hand,
+    // the same way HardwareSerial does.
+    if (bit_is_set(SREG, SREG_I)) {
+        return;
+    }
+
+    if (UCSRA & (1 << UDRE)) {
+        this->txIrq();
+    }
+
+    if ((UCSRB & (1 << TXCIE)) && (UCSRA & (1 << TXC))) {
+        this->txcIrq();
+    }
+}
+
+void UartClass::switchBaud(unsigned long baud, byte lead) {
+    word ubrr = ubrrFor(baud);
+    uint8_t oldSREG = SREG;
+    cli();
+    this->_switchUbrr = ubrr;
+    this->_switchLead = lead;
+    if (!this->_txHeld) {
+        this->_txBarrier = this->_txHead;
+        this->_txHeld = true;
+    }
+
+    if (!this->_txStarted && (this->_txTail == this->_txBarrier)) {
+        // Nothing was ever sent, so TXC will never be set.
+        this->doSwitch();
+    }
+    else {
+        // TXC is set once the last byte before the barrier is out (it is
+        // already set if the line is idle). Until then txIrq() stops at the
+        // barrier.
+        UCSRB |= (1 << TXCIE);
+    }
+
+    SREG = oldSREG;
+}
+
+bool UartClass::isSwitching() {
+    this->pollTx();
+    return this->_txHeld;
+}
+
+bool UartClass::checkReceived() {
+    uint8_t oldSREG = SREG;
+    cli();
+    bool received = this->_received;
+    this->_received = false;
+    SREG = oldSREG;
+    return received;
+}
+
+UartStats UartClass::stats() {
+    uint8_t oldSREG = SREG;
+    cli();
+    UartStats copy = this->_stats;
+    SREG = oldSREG;
+    return copy;
+}
+
+void UartClass::updateRts() {
+    #ifdef UART_FLOW_CONTROL
+    FastPin<UART_PIN_RTS>::write(this->available() > (UART_RX_BUFFER_SIZE - RTS_THRESHOLD));
+    #endif
+}
+
+inline void UartClass::rxIrq() {
+    byte status = UCSRA;
+    byte data = UDR;
+    if (status & (1 << DOR)) {
+        // The data register overflowed: at least one byte was lost before this one.
+        saturatingInc(this->_stats.rxOverruns);
+    }
+
+    if (status & ((1 << FE) | (1 << PE))) {
+        saturatingInc(this->_stats.rxErrors);
+        return;
+    }
+
+    byte next = (this->_rxHead + 1) & RX_MASK;
+    if (next == this->_rxTail) {
+        saturatingInc(this->_stats.rxOverruns);
+        return;
+    }
+
+    this->_rxBuffer[this->_rxHead] = data;
+    this->_rxHead = next;
+    this->_received = true;
+    this->updateRts();
+}
+
+inline void UartClass::txIrq() {
+    #ifdef UART_FLOW_CONTROL
+    if (FastPin<UART_PIN_CTS>::read()) {
+        // The host is not ready: stop until service() sees CTS again.
+        UCSRB &= ~(1 << UDRIE);
+        return;
+    }
+    #endif
+
+    if ((this->_txHead == this->_txTail) || (this->_txHeld && (this->_txTail == this->_txBarrier))) {
+        UCSRB &= ~(1 << UDRIE);
+        return;
+    }
+
+    UDR = this->_txBuffer[this->_txTail];
+    this->_txTail = (this->_txTail + 1) & TX_MASK;
+
+    // Clear TXC (by writing a 1), so flush() can wait for the end of this byte.
+    UCSRA = (UCSRA & (1 << U2X)) | (1 << TXC);
+    this->_txStarted = true;
+}
+
+inline void UartClass::txcIrq() {
+    if (this->_txHeld && (this->_txTail == this->_txBarrier)) {
+        // The old output is out and the line is idle.
+        this->doSwitch();
+    }
+}
+
+void UartClass::doSwitch() {
+    // Switch, then send the lead byte ahead of the held ones.
+    UCSRB &= ~(1 << TXCIE);
+    this->setUbrr(this->_switchUbrr);
+    this->_rxHead = this->_rxTail;
+    this->_received = false;
+    UDR = this->_switchLead;
+    UCSRA = (UCSRA & (1 << U2X)) | (1 << TXC);
+    this->_txStarted = true;
+    this->_txHeld = false;
+    if (this->_txHead != this->_txTail) {
+        UCSRB |= (1 << UDRIE);
+    }
+
+    this->updateRts();
+}
+
+ISR(USART_RXC_vect) {
+    Uart.rxIrq();
+}
+
+ISR(USART_UDRE_vect) {
+    Uart.txIrq();
+}
+
+ISR(USART_TXC_vect) {
+    Uart.txcIrq();
+}
+
+UartClass Uart;
@@ -1,25 +1,30 @@
 #include "hal.h"
+#include "Uart.h"
+#include "FastPin.h"
 #include "opcodes.h"
+#include "BootProfiler.h"
 
 void pulseClock(byte numPulse) {
 	for (byte i = 0; i < numPulse; i++) {
-		digitalWrite(PIN_CLK, HIGH);
-		digitalWrite(PIN_CLK, LOW);
+		FastPin<PIN_CLK>::high();
+		// Keep CLK high for the minimum Z80 clock pulse width even at 20MHz.
+		__asm__ __volatile__ ("nop");
+		FastPin<PIN_CLK>::low();
 	}
 }
 
 void singlePulseResetZ80() {
-	digitalWrite(PIN_RESET, LOW);
+	FastPin<PIN_RESET>::low();
 	pulseClock(6);
-	digitalWrite(PIN_RESET, HIGH);
+	FastPin<PIN_RESET>::high();
 	pulseClock(2);
 }
 
-void loadHL(word value) {
+static void injectOpcodeNN(byte opcode, word value) {
 	pulseClock(1);
-	digitalWrite(PIN_RAM_CE2, LOW);
+	FastPin<PIN_RAM_CE2>::low();
 	DDRA = 0xFF;
-	PORTA = OPC_LD_HL_NN;
+	PORTA = opcode;
 	pulseClock(2);
 	DDRA = 0x00;
 	PORTA = 0xFF;
@@ -33,12 +38,20 @@ void loadHL(word value) {
 	pulseClock(2);
 	DDRA = 0x00;
 	PORTA = 0xFF;
-	digitalWrite(PIN_RAM_CE2, HIGH);
+	FastPin<PIN_RAM_CE2>::high();
+}
+
+void loadHL(word value) {
+	injectOpcodeNN(OPC_LD_HL_NN, value);
+}
+
+void injectJump(word addr) {
+	injectOpcodeNN(OPC_JP_NN, addr);
 }
 
 void loadByteToRAM(byte value) {
 	pulseClock(1);
-	digitalWrite(PIN_RAM_CE2, LOW);
+	FastPin<PIN_RAM_CE2>::low();
 	DDRA = 0xFF;
 	PORTA = OPC_LD_HL;
 	pulseClock(2);
@@ -51,36 +64,94 @@ void loadByteToRAM(byte value) {
 	pulseClock(2);
 	DDRA = 0x00;
 	PORTA = 0xFF;
-	digitalWrite(PIN_RAM_CE2, HIGH);
+	FastPin<PIN_RAM_CE2>::high();
 	pulseClock(3);
 
 	pulseClock(1);
-	digitalWrite(PIN_RAM_CE2, LOW);
+	FastPin<PIN_RAM_CE2>::low();
 	DDRA = 0xFF;
 	PORTA = OPC_INC_HL;
 	pulseClock(2);
 	DDRA = 0x00;
 	PORTA = 0xFF;
-	digitalWrite(PIN_RAM_CE2, HIGH);
+	FastPin<PIN_RAM_CE2>::high();
 	pulseClock(3);
 }
 
-void printBinaryByte(byte value) {
-	for (byte mask = 0x80; mask; mask >>= 1) {
-		Serial.print((mask & value) ? '1' : '0');
+byte readByteFromRAM() {
+	// LD A,(HL): M1 is fed from the data bus, then RAM is enabled so it drives
+	// the data bus during the Memory Read cycle.
+	pulseClock(1);
+	FastPin<PIN_RAM_CE2>::low();
+	DDRA = 0xFF;
+	PORTA = OPC_LD_A_HL;
+	pulseClock(2);
+	DDRA = 0x00;
+	PORTA = 0xFF;
+	FastPin<PIN_RAM_CE2>::high();
+	pulseClock(3);
+	byte value = PINA;
+	pulseClock(1);
+
+	pulseClock(1);
+	FastPin<PIN_RAM_CE2>::low();
+	DDRA = 0xFF;
+	PORTA = OPC_INC_HL;
+	pulseClock(2);
+	DDRA = 0x00;
+	PORTA = 0xFF;
+	FastPin<PIN_RAM_CE2>::high();
+	pulseClock(3);
+	return value;
+}
+
+void setOsBank(byte osBank) {
+	switch (osBank) {
+		case OS_MEM_BANK_0:
+			// Set physical bank 0 (logical bank 1)
+			FastPin<PIN_BANK0>::high();
+			FastPin<PIN_BANK1>::low();
+			break;
+		case OS_MEM_BANK_1:
+			FastPin<PIN_BANK0>::high();
+			FastPin<PIN_BANK1>::high();
+			break;
+		case OS_MEM_BANK_2:
+			FastPin<PIN_BANK0>::low();
+			FastPin<PIN_BANK1>::high();
+			break;
+		default:
+			break;
 	}
 }
 
-// TODO This is unused. Do we really need it?
-void serialEvent(bool intFlagUsed) {
-	if ((Serial.available()) && intFlagUsed) {
-		digitalWrite(PIN_INT, LOW);
+void startZ80Clock(byte ocr) {
+	ASSR &= ~(1 << AS2);
+	TCCR2 |= (1 << CS20);
+	TCCR2 &= ~((1 << CS21) | (1 << CS22));
+	TCCR2 |= (1 << WGM21);
+	TCCR2 &= ~(1 << WGM20);
+	TCCR2 |= (1 << COM20);
+	TCCR2 &= ~(1 << COM21);
+	OCR2 = ocr;
+	pinMode(PIN_CLK, OUTPUT);
+}
+
+void stopZ80Clock() {
+	// Disconnect OC2 from the pin, so PIN_CLK is a plain output again.
+	TCCR2 &= ~((1 << COM20) | (1 << COM21));
+	digitalWrite(PIN_CLK, LOW);
+}
+
+void printBinaryByte(byte value) {
+	for (byte mask = 0x80; mask; mask >>= 1) {
+		Uart.print((mask & value) ? '1' : '0');
 	}
 }
 
 void flushSerialRXBuffer() {
-	while (Serial.available() > 0) {
-		Serial.read();
+	while (Uart.available() > 0) {
+		Uart.read();
 	}
 }
 
@@ -91,40 +162,89 @@ void blinkIOSled(unsigned long *timestamp) {
 	}
 }
 
+static SDMountState sdState = SDMountState::UNMOUNTED;
+static FATFS* sdMountedFs = NULL;
+
+/**
+ * @brief Marks the mount as faulted on a disk level error, so the next
+ * mountSD() fully initializes the card again.
+ */
+static byte checkSD(byte errCode) {
+	switch (errCode) {
+		case ERR_DSK_EMU_DISK_ERR:
+		case ERR_DSK_EMU_NOT_READY:
+		case ERR_DSK_EMU_NO_FILESYSTEM:
+			sdState = SDMountState::FAULT;
+			break;
+		default:
+			break;
+	}
+
+	return errCode;
+}
+
 byte mountSD(FATFS* fatfs) {
+	if ((sdState == SDMountState::MOUNTED) && (fatfs == sdMountedFs) && !disk_status()) {
+		fatfs->flag = 0;
+		return ERR_DSK_EMU_OK;
+	}
+
 	#ifdef DEBUG
-	Serial.println(F("DEBUG: Mounting SD filesystem ..."));
+	Uart.println(F("DEBUG: Mounting SD filesystem ..."));
 	#endif
-	return pf_mount(fatfs);
+	PROFILE_BEGIN(BootStep::SD_MOUNT);
+	byte errCode = pf_mount(fatfs);
+	PROFILE_END(BootStep::SD_MOUNT);
+	sdState = errCode ? SDMountState::FAULT : SDMountState::MOUNTED;
+	sdMountedFs = fatfs;
+	return errCode;
+}
+
+SDMountState getSDMountState() {
+	return sdState;
+}
+
+byte remountSD(FATFS* fatfs, byte cardType, unsigned long volid) {
+	if (disk_resume(cardType)) {
+		return ERR_DSK_EMU_NOT_READY;
+	}
+
+	byte errCode = pf_remount(fatfs, volid);
+	if (!errCode) {
+		sdState = SDMountState::MOUNTED;
+		sdMountedFs = fatfs;
+	}
+
+	return errCode;
 }
 
 byte openSD(const char* fileName) {
-	return pf_open(fileName);
+	return checkSD(pf_open(fileName));
 }
 
-byte readSD(void* buffSD, byte* readBytes) {
+byte readSD(void* buffSD, byte* readBytes, byte len) {
 	UINT numBytes;
-	byte errCode = pf_read(buffSD, MAX_SECTORS, &numBytes);
+	byte errCode = pf_read(buffSD, len, &numBytes);
 	*readBytes = (byte)numBytes;
-	return errCode;
+	return checkSD(errCode);
 }
 
 byte seekSD(word sectNum) {
-	return pf_lseek(((unsigned long)sectNum) << 9);
+	return checkSD(pf_lseek(((unsigned long)sectNum) << 9));
 }
 
-byte writeSD(void* buffSD, byte* numWrittenBytes) {
+byte writeSD(void* buffSD, byte* numWrittenBytes, byte len) {
 	UINT numBytes;
 	byte errorCode;
 	if (buffSD != NULL) {
-		errorCode = pf_write(buffSD, MAX_SECTORS, &numBytes);
+		errorCode = pf_write(buffSD, len, &numBytes);
 	}
 	else {
 		errorCode = pf_write(0, 0, &numBytes);
 	}
 
 	*numWrittenBytes = (byte)numBytes;
-	return errorCode;
+	return checkSD(errorCode);
 }
 
 void printErrSD(byte opType, byte errCode, const char* fileName) {
@@ -132,73 +252,83 @@ void printErrSD(byte opType, byte errCode, const char* fileName) {
 		return;
 	}
 
-	Serial.print(F("\r\nIOS: SD error "));
-	Serial.print(errCode);
-	Serial.print(F(" ("));
+	Uart.print(F("\r\nIOS: SD error "));
+	Uart.print(errCode);
+	Uart.print(F(" ("));
 	switch (errCode) {
 		case ERR_DSK_EMU_DISK_ERR:
-			Serial.print(F("DISK_ERR"));
+			Uart.print(F("DISK_ERR"));
 			break;
 		case ERR_DSK_EMU_NOT_READY:
-			Serial.print(F("NOT_READY"));
+			Uart.print(F("NOT_READY"));
 			break;
 		case ERR_DSK_EMU_NO_FILE:
-			Serial.print(F("NO_FILE"));
+			Uart.print(F("NO_FILE"));
 			break;
 		case ERR_DSK_EMU_NOT_OPENED:
-			Serial.print(F("NOT_OPENED"));
+			Uart.print(F("NOT_OPENED"));
 			break;
 		case ERR_DSK_EMU_NOT_ENABLED:
-			Serial.print(F("NOT_ENABLED"));
+			Uart.print(F("NOT_ENABLED"));
 			break;
 		case ERR_DSK_EMU_NO_FILESYSTEM:
-			Serial.print(F("NO_FILESYSTEM"));
+			Uart.print(F("NO_FILESYSTEM"));
+			break;
+		case ERR_DSK_EMU_UNEXPECTED_EOF:
+			Uart.print(F("UNEXPECTED_EOF"));
+			break;
+		case ERR_DSK_EMU_BAD_SNAPSHOT:
+			Uart.print(F("BAD_SNAPSHOT"));
+			break;
+		case ERR_DSK_EMU_BAD_MANIFEST:
+			Uart.print(F("BAD_MANIFEST"));
 			break;
 		default:
-			Serial.print(F("UNKNOWN"));
+			Uart.print(F("UNKNOWN"));
 			break;
 	}
 
-	Serial.print(F(" on "));
+	Uart.print(F(" on "));
 	switch (opType) {
 		case SD_OP_TYPE_MOUNT:
-			Serial.print(F("MOUNT"));
+			Uart.print(F("MOUNT"));
 			break;
 		case SD_OP_TYPE_OPEN:
-			Serial.print(F("OPEN"));
+			Uart.print(F("OPEN"));
 			break;
 		case SD_OP_TYPE_READ:
-			Serial.print(F("READ"));
+			Uart.print(F("READ"));
 			break;
 		case SD_OP_TYPE_WRITE:
-			Serial.print(F("WRITE"));
+			Uart.print(F("WRITE"));
 			break;
 		case SD_OP_TYPE_SEEK:
-			Serial.print(F("SEEK"));
+			Uart.print(F("SEEK"));
 			break;
 		default:
-			Serial.print(F("UNKNOWN"));
+			Uart.print(F("UNKNOWN"));
 			break;
 	}
 
-	Serial.print(F(" operation"));
+	Uart.print(F(" operation"));
 	if (fileName) {
-		Serial.print(F(" - File: "));
-		Serial.print(fileName);
+		Uart.print(F(" - File: "));
+		Uart.print(fileName);
 	}
 	
-	Serial.println(F(")"));
+	Uart.println(F(")"));
 }
 
 void waitKeySD() {
 	flushSerialRXBuffer();
-	Serial.println(F("IOS: Check SD and press a key to repeat\r\n"));
-	while (Serial.available() < 1);
+	Uart.println(F("IOS: Check SD and press a key to repeat\r\n"));
+	while (Uart.available() < 1);
 }
 
 void exitWaitState() {
-	digitalWrite(PIN_BUSREQ, LOW);     // Request for DMA.
-	digitalWrite(PIN_WAIT_RES, LOW);   // Reset WAIT FF exiting from WAIT state.
-	digitalWrite(PIN_WAIT_RES, HIGH);  // Now Z80 is in DMA, so it's safe to set WAIT_RES HIGH again.
-	digitalWrite(PIN_BUSREQ, HIGH);    // Resume Z80 from DMA.
+	FastPin<PIN_BUSREQ>::low();        // Request for DMA.
+	FastPin<PIN_WAIT_RES>::low();      // Reset WAIT FF exiting from WAIT state.
+	holdIoCycle();                     // Wait for the Z80 to end the I/O cycle and enter DMA.
+	FastPin<PIN_WAIT_RES>::high();     // Now Z80 is in DMA, so it's safe to set WAIT_RES HIGH again.
+	FastPin<PIN_BUSREQ>::high();       // Resume Z80 from DMA.
 }
\ No newline at end of file
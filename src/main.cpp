@@ -14,9 +14,10 @@
 #endif
 
 #include <Arduino.h>
-#include <Wire.h>
+#include <util/crc16.h>
 #include "BiosSettings.h"
 #include "Buzzer.h"
+#include "FastPin.h"
 #include "hal.h"
 #include "iLoad.h"
 #include "LED.h"
@@ -25,6 +26,13 @@
 #include "ToggleSwitch.h"
 #include "BusControl.h"
 #include "CyBorgSPP.h"
+#include "Snapshot.h"
+#include "BootManifest.h"
+#include "BootProfiler.h"
+#include "HwProfile.h"
+#include "IoDispatch.h"
+#include "Uart.h"
+#include "TwiBus.h"
 
 #define FW_VERSION "1.2"
 
@@ -36,25 +44,30 @@ Buzzer pcSpk(PIN_PC_SPK, NULL, NULL);
 bool hasRTC = false;
 bool hasExtendedRxBuf = false;
 bool isSlowClock = false;
-bool z80IntEnFlag = false;  // TODO We set this flag, but never consume it anywhere.
+bool z80IntEnFlag = false;
 bool z80IntSysTick = false;
+bool z80IntGpio = false;
+bool z80IntSlots = false;
+byte slotChangeStep = 0;   // Next step of a card slot change (serviceSlotInterrupt()).
 bool lastRxIsEmpty = false;
 FATFS filesysSD;
 unsigned long timestamp = 0;
 char inChar;
 char OsName[11] = DS_OSNAME;
-byte bufferSD[32];
+char manifestName[12] = DS_MANIFEST;
+static_assert(!(SD_SECTOR_SIZE % SD_DISK_BUFFER_SIZE) && (SD_DISK_BUFFER_SIZE < 256), "SD_DISK_BUFFER_SIZE must divide SD_SECTOR_SIZE");
+byte bufferSD[SD_DISK_BUFFER_SIZE];
 byte numReadBytes = 0;
 byte iCount = 0;
 word bootStrAddr = boot_A_StrAddr;
-word bootImageSize = sizeof(boot_A_);
+ResidentPayload residentPayload;
+bool hasResidentPayload = false;
 const char* fileNameSD;
-byte* bootImage;
 char diskName[11] = Z80DISK;
 byte ioAddress = 0;
 byte ioData = 0;
 byte ioOpCode = 0;
-byte ioByteCount = 0;
+word ioByteCount = 0;
 byte diskErr = ERR_DSK_EMU_UNEXPECTED_EOF;
 word trackSel = 0;
 byte sectSel = 0;
@@ -63,20 +76,42 @@ byte numWriBytes = 0;
 byte irqStatus = 0;
 byte sysTickTime = 100;
 bool showBootMenu = false;
+bool hwProfileValid = false;
+bool sdRemounted = false;
+bool bootFileOpen = false;
+unsigned long runTriggerStart = 0;
+volatile byte jingleNote = 0;
+volatile word jingleTicksLeft = 0;
+volatile bool jinglePlaying = false;
+const IoSlotCard* ioSlotCards[IO_SLOT_COUNT];   // Card tables attached to the slots (slot OpCodes).
+byte sppSlot = IO_SLOT_NONE;                    // Slot of the parallel port card.
+
+void findSlotCards();
+byte osBank = OS_MEM_BANK_0;
+byte diskNum = OP_IO_NOP;
+word hibernateAddr = ZERO_ADDR;
+bool hibernateRequested = false;
+bool entryInjected = false;
+BaudRate currentBaudRate = BaudRate::B115200;
+BaudRate previousBaudRate = BaudRate::B115200;
+bool baudSwitchPending = false;
+bool baudSwitchSave = false;
+unsigned long baudSwitchTime = 0;
 
 void initSerial() {
-	Serial.begin(SERIAL_BAUD_RATE);
-	Serial.print(F("CyBorg BIOS v"));
-	Serial.println(FW_VERSION);
-	Serial.println(F("Copyright (c) 2023 Cyrus Brunner"));
+	currentBaudRate = BiosSettings::readBaudRate();
+	Uart.begin(baudRateValue(currentBaudRate));
+	Uart.print(F("CyBorg BIOS v"));
+	Uart.println(FW_VERSION);
+	Uart.println(F("Copyright (c) 2023 Cyrus Brunner"));
 	#ifdef DEBUG
-	Serial.println(F("INIT: Boot stage 0."));
+	Uart.println(F("INIT: Boot stage 0."));
 	#endif
 }
 
 void initCpuSuspended() {
 	#ifdef DEBUG
-	Serial.print(F("INIT: boot0 - Initializing CPU suspended... "));
+	Uart.print(F("INIT: boot0 - Initializing CPU suspended... "));
 	#endif
 	// Configure RESET and set it ACTIVE.
 	pinMode(PIN_RESET, OUTPUT);
@@ -86,23 +121,30 @@ void initCpuSuspended() {
 	pinMode(PIN_WAIT_RES, OUTPUT);
 	digitalWrite(PIN_WAIT_RES, LOW);
 	#ifdef DEBUG
-	Serial.println(F("DONE"));
+	Uart.println(F("DONE"));
 	#endif
 }
 
 void initRunTrigger() {
 	pinMode(PIN_RUN, INPUT);
+	runTriggerStart = millis();
+}
+
+void awaitRunTrigger() {
 	#ifdef DEBUG
-	Serial.println(F("INIT: boot0 - Waiting for boot signal from Southbridge..."));
+	Uart.println(F("INIT: boot0 - Waiting for boot signal from Southbridge..."));
 	#endif
-	delay(200);
-	while (true) {
-		if (digitalRead(PIN_RUN) == HIGH) {
-			break;
-		}
-		
-		delay(10);
+	PROFILE_BEGIN(BootStep::RUN_TRIGGER);
+
+	// The 200ms settle time counts from initRunTrigger(), so whatever boot
+	// work was done in the meantime comes off it.
+	while ((millis() - runTriggerStart) < 200) {
+	}
+
+	while (digitalRead(PIN_RUN) != HIGH) {
 	}
+
+	PROFILE_END(BootStep::RUN_TRIGGER);
 }
 
 void bootStage0() {
@@ -112,29 +154,29 @@ void bootStage0() {
 }
 
 void awaitUserInput() {
-	while (Serial.available() < 1) {
+	while (Uart.available() < 1) {
 		blinkIOSled(&timestamp);
 	}
 }
 
 bool checkUserButton() {
 	#ifdef DEBUG
-	Serial.println(F("INIT: boot1 - Checking USER button..."));
+	Uart.println(F("INIT: boot1 - Checking USER button..."));
 	#endif
 	pinMode(PIN_USER, INPUT_PULLUP);
 	#ifdef DEBUG
-	Serial.print(F("DEBUG: User button state: "));
+	Uart.print(F("DEBUG: User button state: "));
 	#endif
 	int state = digitalRead(PIN_USER);
 	#ifdef DEBUG
-	Serial.println(state);
+	Uart.println(state);
 	#endif
 	return (state == LOW);
 }
 
 void initSystemControl() {
 	#ifdef DEBUG
-	Serial.print(F("INIT: boot1 - Initializing system control... "));
+	Uart.print(F("INIT: boot1 - Initializing system control... "));
 	#endif
 	
 	// Turn USER LED off.
@@ -158,47 +200,100 @@ void initSystemControl() {
 	pinMode(PIN_BUSREQ, OUTPUT);
 	digitalWrite(PIN_BUSREQ, HIGH);
 	#ifdef DEBUG
-	Serial.println(F("DONE"));
+	Uart.println(F("DONE"));
 	#endif
 }
 
 void initSpeaker() {
 	#ifdef DEBUG
-	Serial.print(F("INIT: boot1 - Initializing PC speaker driver... "));
+	Uart.print(F("INIT: boot1 - Initializing PC speaker driver... "));
 	#endif
 	pcSpk.init();
 	#ifdef DEBUG
-	Serial.println(F("DONE"));
+	Uart.println(F("DONE"));
 	#endif
 }
 
+// Startup jingle notes (frequency, duration in ms).
+const word startupJingle[][2] PROGMEM = {
+	{(word)BuzzerNotes::BUZZER_NOTE_C, 50},
+	{(word)BuzzerNotes::BUZZER_NOTE_A, 50},
+	{(word)BuzzerNotes::BUZZER_NOTE_C, 50},
+	{(word)BuzzerNotes::BUZZER_NOTE_F, 500},
+	{(word)BuzzerNotes::BUZZER_NOTE_C, 50},
+	{(word)BuzzerNotes::BUZZER_NOTE_F, 900}
+};
+
+#define JINGLE_NOTES (sizeof(startupJingle) / sizeof(startupJingle[0]))
+
+/**
+ * @brief Steps the startup jingle. Timer0 (millis()) runs in its ~1ms
+ * overflow period, so its compare match gives a free ~1ms tick while the
+ * jingle plays.
+ */
+ISR(TIMER0_COMP_vect) {
+	if (--jingleTicksLeft) {
+		return;
+	}
+
+	jingleNote++;
+	if (jingleNote >= JINGLE_NOTES) {
+		TIMSK &= ~(1 << OCIE0);
+		pcSpk.off();
+		jinglePlaying = false;
+		return;
+	}
+
+	pcSpk.buzz(pgm_read_word(&startupJingle[jingleNote][0]), 0UL);
+	jingleTicksLeft = pgm_read_word(&startupJingle[jingleNote][1]);
+}
+
+void stopStartupJingle() {
+	TIMSK &= ~(1 << OCIE0);
+	if (jinglePlaying) {
+		pcSpk.off();
+		jinglePlaying = false;
+	}
+}
+
 void playErrorSound() {
+	stopStartupJingle();
 	pcSpk.buzz(50, 150);
 }
 
 void playStartupJingle() {
-	pcSpk.playNote(BuzzerNotes::BUZZER_NOTE_C, 50);
-	pcSpk.playNote(BuzzerNotes::BUZZER_NOTE_A, 50);
-	pcSpk.playNote(BuzzerNotes::BUZZER_NOTE_C, 50);
-	pcSpk.playNote(BuzzerNotes::BUZZER_NOTE_F, 500);
-	pcSpk.playNote(BuzzerNotes::BUZZER_NOTE_C, 50);
-	pcSpk.playNote(BuzzerNotes::BUZZER_NOTE_F, 900);
+	// Plays in the background from the Timer0 compare match interrupt.
+	jingleNote = 0;
+	jingleTicksLeft = pgm_read_word(&startupJingle[0][1]);
+	jinglePlaying = true;
+	pcSpk.buzz(pgm_read_word(&startupJingle[0][0]), 0UL);
+	OCR0 = 0x80;
+	TIFR = (1 << OCF0);
+	TIMSK |= (1 << OCIE0);
+}
+
+void awaitStartupJingle() {
+	PROFILE_BEGIN(BootStep::JINGLE);
+	while (jinglePlaying) {
+	}
+
+	PROFILE_END(BootStep::JINGLE);
 }
 
 void bootStage1() {
 	#ifdef DEBUG
-	Serial.println(F("INIT: Boot stage 1."));
-	Serial.println(F("INIT: boot1 - CyBorg is alive!\r\nCyBorg IOS - I/O Subsystem\r\n"));
-	Serial.print(F("INIT: boot1 - Northbridge FW v"));
-	Serial.println(FW_VERSION);
-	Serial.print(F("INIT: boot1 - Compiled "));
-	Serial.print(compDateStr);
-	Serial.print(F(" "));
-	Serial.println(compTimeStr);
+	Uart.println(F("INIT: Boot stage 1."));
+	Uart.println(F("INIT: boot1 - CyBorg is alive!\r\nCyBorg IOS - I/O Subsystem\r\n"));
+	Uart.print(F("INIT: boot1 - Northbridge FW v"));
+	Uart.println(FW_VERSION);
+	Uart.print(F("INIT: boot1 - Compiled "));
+	Uart.print(compDateStr);
+	Uart.print(F(" "));
+	Uart.println(compTimeStr);
 	#endif
-	if (SERIAL_RX_BUFFER_SIZE >= 128) {
+	if (UART_RX_BUFFER_SIZE >= 128) {
 		#ifdef DEBUG
-		Serial.println(F("INIT: boot1 - IOS: Found extended serial RX buffer."));
+		Uart.println(F("INIT: boot1 - IOS: Found extended serial RX buffer."));
 		#endif
 		hasExtendedRxBuf = true;
 	}
@@ -206,15 +301,18 @@ void bootStage1() {
 	initSpeaker();
 	showBootMenu = checkUserButton();
 	#ifdef DEBUG
-	Serial.print(F("DEBUG: Show boot menu: "));
-	Serial.println(showBootMenu);
+	Uart.print(F("DEBUG: Show boot menu: "));
+	Uart.println(showBootMenu);
 	#endif
 	initSystemControl();
+	if (biosSettings_t.enableStartupJingle) {
+		playStartupJingle();
+	}
 }
 
 void initDataBus() {
 	#ifdef DEBUG
-	Serial.print(F("INIT: boot2 - Initializing data bus... "));
+	Uart.print(F("INIT: boot2 - Initializing data bus... "));
 	#endif
 
 	// Configure Z80 Data bus (D0 - D7 [PA0 - PA7]) as input w/pullup
@@ -227,13 +325,13 @@ void initDataBus() {
 	pinMode(PIN_WR, INPUT_PULLUP);
 	pinMode(PIN_AD0, INPUT_PULLUP);
 	#ifdef DEBUG
-	Serial.println(F("DONE"));
+	Uart.println(F("DONE"));
 	#endif
 }
 
 void initRAM() {
 	#ifdef DEBUG
-	Serial.print(F("INIT: boot2 - Initializing RAM... "));
+	Uart.print(F("INIT: boot2 - Initializing RAM... "));
 	#endif
 	// Configure logical RAM bank (32KB) to map into lower half of Z80 address space.
 	pinMode(PIN_BANK0, OUTPUT);  // Set RAM logical bank 1 (OS bank 0)
@@ -241,24 +339,24 @@ void initRAM() {
 	pinMode(PIN_BANK1, OUTPUT);
 	digitalWrite(PIN_BANK1, LOW);
 	#ifdef DEBUG
-	Serial.println(F("DONE"));
+	Uart.println(F("DONE"));
 	#endif
 }
 
 void initCpuClock() {
 	#ifdef DEBUG
-	Serial.print(F("INIT: boot2 - Initializing CPU clock... "));
+	Uart.print(F("INIT: boot2 - Initializing CPU clock... "));
 	#endif
 	pinMode(PIN_CLK, OUTPUT);
 	singlePulseResetZ80();
 	#ifdef DEBUG
-	Serial.println(F("DONE"));
+	Uart.println(F("DONE"));
 	#endif
 }
 
 void bootStage2() {
 	#ifdef DEBUG
-	Serial.println(F("INIT: Boot stage 2."));
+	Uart.println(F("INIT: Boot stage 2."));
 	#endif
 	initDataBus();
 	initRAM();
@@ -267,35 +365,35 @@ void bootStage2() {
 
 void loadBiosSettings() {
 	#ifdef DEBUG
-	Serial.print(F("INIT: boot3 - Loading BIOS settings... "));
+	Uart.print(F("INIT: boot3 - Loading BIOS settings... "));
 	#endif
 	biosSettings_t.load();
 	#ifdef DEBUG
-	Serial.println(F("DONE"));
-	Serial.print(F("DEBUG: Loaded boot mode: "));
-	Serial.println((uint8_t)biosSettings_t.bootMode);
+	Uart.println(F("DONE"));
+	Uart.print(F("DEBUG: Loaded boot mode: "));
+	Uart.println((uint8_t)biosSettings_t.bootMode);
 	#endif
 	
 	#ifdef DEBUG
-	Serial.print(F("INIT: boot3 - IOS: CPU clock set at "));
+	Uart.print(F("INIT: boot3 - IOS: CPU clock set at "));
 	#endif
 	isSlowClock = biosSettings_t.clockMode == ClockMode::SLOW;
 	#ifdef DEBUG
-	Serial.print(isSlowClock ? CLOCK_LOW : CLOCK_HIGH);
-	Serial.println(F("MHz"));
+	Uart.print(isSlowClock ? CLOCK_LOW : CLOCK_HIGH);
+	Uart.println(F("MHz"));
 	
-	Serial.print(F("INIT: boot3 - IOS: CP/M Autoexec is "));
-	Serial.println(biosSettings_t.autoExecFlag ? F("ON") : F("OFF"));
+	Uart.print(F("INIT: boot3 - IOS: CP/M Autoexec is "));
+	Uart.println(biosSettings_t.autoExecFlag ? F("ON") : F("OFF"));
 	#endif
 }
 
 void initI2C() {
 	#ifdef DEBUG
-	Serial.print(F("INIT: boot3 - Initializing I2C bus... "));
+	Uart.print(F("INIT: boot3 - Initializing I2C bus... "));
 	#endif
-	Wire.begin();
+	TwiBus.begin();
 	#ifdef DEBUG
-	Serial.println(F("DONE"));
+	Uart.println(F("DONE"));
 	#endif
 }
 
@@ -305,7 +403,7 @@ void initBusController() {
 		return;
 	}
 
-	Serial.println(F("INIT: boot3 - IOS: Detecting installed cards ..."));
+	Uart.println(F("INIT: boot3 - IOS: Detecting installed cards ..."));
 	BusControl.detectCards();
 	for (uint8_t i = 1; i < 4; i++) {
 		bool detected = false;
@@ -324,9 +422,9 @@ void initBusController() {
 		}
 
 		if (detected) {
-			Serial.printf(F("INIT: Card in slot "));
-			Serial.print(i);
-			Serial.println(F(" present"));
+			Uart.printf(F("INIT: Card in slot "));
+			Uart.print(i);
+			Uart.println(F(" present"));
 		}
 	}
 }
@@ -334,29 +432,71 @@ void initBusController() {
 void detectParallelPort() {
 	if (BusControl.hasBUSCTLR() && !BusControl.noCardsPresent()) {
 		CyBorgSPP.detect();
+		#ifdef DEBUG
+		if (CyBorgSPP.isPresent()) {
+			Uart.println(F("INIT: boot3 - IOS: Found Standard Parallel Port card"));
+		}
+		#endif
+	}
+}
+
+bool restoreDevices() {
+	// Warm boot: check the devices from the hardware profile are still there
+	// (one address ping each) instead of running the full discovery.
+	BusControl.init();
+	if ((BusControl.hasIOEXP() != hwProfile_t.hasDevice(HW_DEV_IOEXP))
+		|| (BusControl.hasBUSCTLR() != hwProfile_t.hasDevice(HW_DEV_BUSCTLR))) {
+		return false;
+	}
+
+	hasRTC = RTC.isPresent();
+	if (hasRTC != hwProfile_t.hasDevice(HW_DEV_RTC)) {
+		return false;
+	}
+
+	if (BusControl.hasBUSCTLR()) {
+		BusControl.restoreCards(hwProfile_t.hasDevice(HW_DEV_CARD1),
+			hwProfile_t.hasDevice(HW_DEV_CARD2),
+			hwProfile_t.hasDevice(HW_DEV_CARD3));
 	}
+
+	detectParallelPort();
+	return CyBorgSPP.isPresent() == hwProfile_t.hasDevice(HW_DEV_SPP);
 }
 
 void bootStage3() {
 	#ifdef DEBUG
-	Serial.println(F("INIT: Boot stage 3."));
+	Uart.println(F("INIT: Boot stage 3."));
 	#endif
 	loadBiosSettings();
-	hasRTC = RTC.autoSet();
-	initBusController();
-	detectParallelPort();
+	PROFILE_BEGIN(BootStep::I2C_PROBE);
+	hwProfileValid = hwProfile_t.isWarmBoot() && hwProfile_t.load();
+	if (hwProfileValid && restoreDevices()) {
+		#ifdef DEBUG
+		Uart.println(F("INIT: boot3 - IOS: Warm boot, using the hardware profile"));
+		#endif
+	}
+	else {
+		hwProfileValid = false;
+		hasRTC = RTC.autoSet();
+		initBusController();
+		detectParallelPort();
+	}
+
+	findSlotCards();
+	PROFILE_END(BootStep::I2C_PROBE);
 }
 
 void printOsName(byte currentDiskSet) {
-	Serial.print(F("Disk Set "));
-	Serial.print(currentDiskSet);
+	Uart.print(F("Disk Set "));
+	Uart.print(currentDiskSet);
 	OsName[2] = currentDiskSet + 48;
 	openSD(OsName);
 	readSD(bufferSD, &numReadBytes);
 	if (numReadBytes > 0) {
-		Serial.print(F(" ("));
-		Serial.print((const char*)bufferSD);
-		Serial.print(F(")"));
+		Uart.print(F(" ("));
+		Uart.print((const char*)bufferSD);
+		Uart.print(F(")"));
 	}
 }
 
@@ -381,21 +521,78 @@ void handleToggleStartupJingle() {
 	biosSettings_t.save();
 }
 
+/**
+ * @brief Switches the console to a new BAUD rate once all pending output was
+ * sent at the old one, then sends XON at the new rate so the host knows it
+ * took effect. Pending input is dropped. Doesn't wait: the UART switches by
+ * itself when the old output is out (see Uart.isSwitching()), and output
+ * written in the meantime follows the XON.
+ *
+ * @param rate The new BAUD rate.
+ */
+void switchBaudRate(BaudRate rate) {
+	Uart.switchBaud(baudRateValue(rate), KEY_CODE_XON);
+	currentBaudRate = rate;
+}
+
+void handleChangeBaudRate() {
+	Uart.println(F("\r\nPress CR to accept, ESC to exit or any other key to change"));
+	iCount = (byte)currentBaudRate;
+	do {
+		iCount = (iCount + 1) % ((byte)MAX_BAUD_RATE + 1);
+		Uart.print(F("\r ->"));
+		Uart.print(baudRateValue((BaudRate)iCount));
+		Uart.print(F(" baud        \r"));
+		flushSerialRXBuffer();
+		awaitUserInput();
+		inChar = Uart.read();
+	} while ((inChar != KEY_CODE_CR) && (inChar != KEY_CODE_ESC));
+
+	Uart.println();
+	if ((inChar != KEY_CODE_CR) || (iCount == (byte)currentBaudRate)) {
+		return;
+	}
+
+	Uart.print(F("IOS: Switch the terminal to "));
+	Uart.print(baudRateValue((BaudRate)iCount));
+	Uart.println(F(" baud and press CR"));
+	previousBaudRate = currentBaudRate;
+	switchBaudRate((BaudRate)iCount);
+	while (Uart.isSwitching());
+
+	// Keep the old rate unless the terminal answers at the new one.
+	timestamp = millis();
+	inChar = 0;
+	while ((inChar != KEY_CODE_CR) && ((millis() - timestamp) < BAUD_CONFIRM_MS)) {
+		inChar = Uart.read();
+	}
+
+	if (inChar == KEY_CODE_CR) {
+		biosSettings_t.baudRate = currentBaudRate;
+		biosSettings_t.save();
+		Uart.println(F("IOS: BAUD rate changed"));
+	}
+	else {
+		switchBaudRate(previousBaudRate);
+		Uart.println(F("\r\nIOS: No answer, BAUD rate restored"));
+	}
+}
+
 void handleChangeDiskSet() {
-	Serial.println(F("\r\nPress CR to accept, ESC to exit or any other key to change"));
+	Uart.println(F("\r\nPress CR to accept, ESC to exit or any other key to change"));
 	iCount = (byte)(biosSettings_t.diskSet - 1);
 	do {
 		iCount = (iCount + 1) % MAX_DISK_SET;
-		Serial.print(F("\r ->"));
+		Uart.print(F("\r ->"));
 		printOsName(iCount);
-		Serial.print(F("                 \r"));
+		Uart.print(F("                 \r"));
 		flushSerialRXBuffer();
 		awaitUserInput();
-		inChar = Serial.read();
+		inChar = Uart.read();
 	} while ((inChar != KEY_CODE_CR) && (inChar != KEY_CODE_ESC));
 
-	Serial.println();
-	Serial.println();
+	Uart.println();
+	Uart.println();
 	if (inChar == KEY_CODE_CR) {
 		biosSettings_t.diskSet = iCount;
 		biosSettings_t.save();
@@ -406,36 +603,36 @@ void handleChangeDiskSet() {
 void handleManualSetRTC() {
 	byte tempByte = 0;
 	RTC.update();
-	Serial.println(F("\nIOS: RTC manual setting:"));
-	Serial.println(F("\nPress T/U to increment +10/+1 or CR to accept"));
+	Uart.println(F("\nIOS: RTC manual setting:"));
+	Uart.println(F("\nPress T/U to increment +10/+1 or CR to accept"));
 	do {
 		do {
-			Serial.print(F(" "));
+			Uart.print(F(" "));
 			switch (tempByte) {
 				case 0:
-					Serial.print(F("Year -> "));
+					Uart.print(F("Year -> "));
 					RTC.print2Digit(RTC.dateTime->year);
 					break;
 				case 1:
-					Serial.print(F("Month -> "));
+					Uart.print(F("Month -> "));
 					RTC.print2Digit(RTC.dateTime->month);
 					break;
 				case 2:
-					Serial.print(F("             "));
-					Serial.write(KEY_CODE_CR);
-					Serial.print(F("Day -> "));
+					Uart.print(F("             "));
+					Uart.write(KEY_CODE_CR);
+					Uart.print(F("Day -> "));
 					RTC.print2Digit(RTC.dateTime->day);
 					break;
 				case 3:
-					Serial.print(F("Hours -> "));
+					Uart.print(F("Hours -> "));
 					RTC.print2Digit(RTC.dateTime->hours);
 					break;
 				case 4:
-					Serial.print(F("Minutes -> "));
+					Uart.print(F("Minutes -> "));
 					RTC.print2Digit(RTC.dateTime->minutes);
 					break;
 				case 5:
-					Serial.print(F("Seconds -> "));
+					Uart.print(F("Seconds -> "));
 					RTC.print2Digit(RTC.dateTime->seconds);
 					break;
 			}
@@ -443,7 +640,7 @@ void handleManualSetRTC() {
 			timestamp = millis();
 			while (inChar != 'u' && inChar != 'U' && inChar != 't' && inChar != 'T' && inChar != KEY_CODE_CR) {
 				blinkIOSled(&timestamp);
-				inChar = Serial.read();
+				inChar = Uart.read();
 			}
 
 			if (inChar == 'u' || inChar == 'U') {
@@ -551,22 +748,25 @@ void handleManualSetRTC() {
 				}
 			}
 
-			Serial.write(KEY_CODE_CR);
+			Uart.write(KEY_CODE_CR);
 		} while (inChar != KEY_CODE_CR);
 
 		tempByte++;
 	} while (tempByte < 6);
 
 	RTC.save();
-	Serial.println(F(" ...done      "));
-	Serial.print(F("IOS: RTC date/time updated ("));
+	Uart.println(F(" ...done      "));
+	Uart.print(F("IOS: RTC date/time updated ("));
 	RTC.printDateTime(true);
-	Serial.println(F(")"));
+	Uart.println(F(")"));
 }
 
 void setBootModeFlags() {
-	// Default to BIOS boot image.
-	bootImage = (byte*)pgm_read_word(&flashBootTable[0]);
+	z80IntEnFlag = false;
+	z80IntSysTick = false;
+
+	// Resident (flash) copy of the boot image, if any.
+	hasResidentPayload = FlashPayload.find((byte)biosSettings_t.bootMode, &residentPayload);
 
 	switch (biosSettings_t.bootMode) {
 		case BootMode::BASIC:
@@ -616,9 +816,7 @@ void setBootModeFlags() {
 			bootStrAddr = AUTSTRADDR;
 			break;
 		case BootMode::ILOAD:
-			bootImage = (byte*)pgm_read_word(&flashBootTable[0]);
-			bootImageSize = sizeof(boot_A_);
-			bootStrAddr = boot_A_StrAddr;
+			bootStrAddr = residentPayload.strAddr;
 			break;
 		default:
 			break;
@@ -626,35 +824,49 @@ void setBootModeFlags() {
 }
 
 void handleMoreSettings() {
-	Serial.println(F(" 0: Back"));
-	Serial.print(F(" 1: Toggle startup jingle (->"));
-	Serial.print(biosSettings_t.enableStartupJingle ? F("ON") : F("OFF"));
-	Serial.println(F(")"));
+	Uart.println(F(" 0: Back"));
+	Uart.print(F(" 1: Toggle startup jingle (->"));
+	Uart.print(biosSettings_t.enableStartupJingle ? F("ON") : F("OFF"));
+	Uart.println(F(")"));
 
-	char minBootChar = '0';
-	char maxSelChar = '0';
 	if (hasRTC) {
-		Serial.println(F(" 2: Change RTC time/date"));
-		maxSelChar = '2';
+		Uart.println(F(" 2: Change RTC time/date"));
 	}
 
-	Serial.println();
+	Uart.println(F(" 3: Resume from RAM snapshot at boot"));
+	Uart.print(F(" 4: Change console BAUD rate ("));
+	Uart.print(baudRateValue(currentBaudRate));
+	Uart.println(F(")"));
+
+	char minBootChar = '0';
+	char maxSelChar = '4';
+
+	Uart.println();
 	timestamp = millis();
-	Serial.print(F("Enter your choice >"));
+	Uart.print(F("Enter your choice >"));
 	do {
 		blinkIOSled(&timestamp);
-		inChar = Serial.read();
+		inChar = Uart.read();
 	} while((inChar < minBootChar) || (inChar > maxSelChar));
 
-	Serial.print(inChar);
-	Serial.println(F(" OK"));
+	Uart.print(inChar);
+	Uart.println(F(" OK"));
 
 	switch (inChar) {
 		case '1':
 			handleToggleStartupJingle();
 			break;
 		case '2':
-			handleManualSetRTC();
+			if (hasRTC) {
+				handleManualSetRTC();
+			}
+			break;
+		case '3':
+			biosSettings_t.bootMode = BootMode::RESUME;
+			biosSettings_t.save();
+			break;
+		case '4':
+			handleChangeBaudRate();
 			break;
 		default:
 			break;
@@ -663,161 +875,289 @@ void handleMoreSettings() {
 	inChar = '9';
 }
 
-void bootStage4() {
-	// TODO do we *need* to do this twice for some reason?
-	// TODO actually, do we need them at all since we call it later on depending on
-	// boot selection???
-	mountSD(&filesysSD);
-	mountSD(&filesysSD);
-	const byte maxBootMode = (byte)BootMode::ILOAD;
-	byte selBootMode = (byte)biosSettings_t.bootMode;
+void selectDisk(byte num) {
+	diskName[2] = biosSettings_t.diskSet + 48;
+	diskName[4] = (num / 10) + 48;
+	diskName[5] = num - ((num / 10) * 10) + 48;
+	diskErr = openSD(diskName);
+	diskNum = num;
+}
 
-	// TODO should we handle edge case scenario here where boot mode could potentially be invalid?
-	if (showBootMenu) {
-		flushSerialRXBuffer();
-		if (biosSettings_t.enableStartupJingle) {
-			playStartupJingle();
-		}
-		
-		Serial.println();
-		Serial.println(F("INIT: boot4 - IOS: Select boot mode or system parameters:"));
-		Serial.println();
-		Serial.print(F(" 0: No change ("));
-		Serial.print(((uint8_t)biosSettings_t.bootMode) + 1);
-		Serial.println(F(")"));
-		Serial.println(F(" 1: BASIC"));
-		Serial.println(F(" 2: Forth"));
-		Serial.print(F(" 3: Load OS from "));
-		printOsName(biosSettings_t.diskSet);
-		Serial.println(F("\r\n 4: Autoboot"));
-		Serial.println(F(" 5: iLoad"));
-		Serial.print(F(" 6: Change Z80 clock speed (->"));
-		Serial.print(biosSettings_t.clockMode == ClockMode::FAST ? CLOCK_HIGH : CLOCK_LOW);
-		Serial.println(F("MHz)"));
-		Serial.print(F(" 7: Toggle CP/M Autoexec (->"));
-		Serial.print(biosSettings_t.autoExecFlag ? F("ON") : F("OFF"));
-		Serial.println(F(")"));
-		Serial.print(F(" 8: Change "));
-		printOsName(biosSettings_t.diskSet);
-		Serial.println();
-		Serial.println(F(" 9: More settings"));
+void hibernateZ80() {
+	SnapshotHeader header;
+	header.resumeAddr = hibernateAddr;
+	header.osBank = osBank;
+	header.z80IntEnFlag = z80IntEnFlag;
+	header.z80IntSysTick = z80IntSysTick;
+	header.sysTickTime = sysTickTime;
+	header.diskNum = diskNum;
+	header.z80IntGpio = z80IntGpio;
+	header.gpioWatch = BusControl.inputWatch();
+	header.z80IntSlots = z80IntSlots;
+
+	// Take the Z80 back onto the injection path. The reset leaves RAM intact.
+	stopZ80Clock();
+	digitalWrite(PIN_INT, HIGH);
+	digitalWrite(PIN_WAIT_RES, LOW);
+	singlePulseResetZ80();
+	digitalWrite(PIN_WAIT_RES, HIGH);
 
-		char minBootChar = '0';
-		char maxSelChar = '9';
+	byte errCode = Snapshot.save(&filesysSD, &header);
+	if (diskNum <= MAX_DISK_NUM) {
+		selectDisk(diskNum);
+	}
 
-		// Ask the user to make a boot selection choice.
-		Serial.println();
-		timestamp = millis();
-		Serial.print(F("Enter your choice >"));
-		do {
-			blinkIOSled(&timestamp);
-			inChar = Serial.read();
-		} while((inChar < minBootChar) || (inChar > maxSelChar));
+	if (errCode) {
+		diskErr = errCode;
+	}
 
-		Serial.print(inChar);
-		Serial.println(F(" OK"));
+	if (debug != DebugMode::OFF) {
+		printErrSD(SD_OP_TYPE_WRITE, errCode, SNAPSHOT_FN);
+	}
 
-		switch (inChar) {
-			case '6':
-				handleToggleClockMode();
-				break;
-			case '7':
-				handleToggleAutoExecFlag();
-				break;
-			case '8':
-				handleChangeDiskSet();
-				break;
-			case '9':
-				handleMoreSettings();
-				break;
-			default:
-				break;
+	injectJump(hibernateAddr);
+	startZ80Clock((byte)biosSettings_t.clockMode);
+}
+
+void resumeFromSnapshot() {
+	SnapshotHeader header;
+	Uart.print(F("INIT: boot4 - IOS: Resuming from RAM snapshot ("));
+	Uart.print(F(SNAPSHOT_FN));
+	Uart.print(F(")..."));
+	bootFileOpen = false;
+	byte errCodeSD = mountSD(&filesysSD);
+	if (!errCodeSD) {
+		errCodeSD = Snapshot.load(&filesysSD, &header);
+	}
+
+	if (errCodeSD) {
+		Uart.println();
+		printErrSD(SD_OP_TYPE_READ, errCodeSD, SNAPSHOT_FN);
+		playErrorSound();
+		return;
+	}
+
+	osBank = header.osBank;
+	z80IntEnFlag = header.z80IntEnFlag;
+	z80IntSysTick = header.z80IntSysTick;
+	sysTickTime = header.sysTickTime;
+	z80IntGpio = header.z80IntGpio;
+	BusControl.setInputWatch(header.gpioWatch);
+	z80IntSlots = header.z80IntSlots;
+	if (header.diskNum <= MAX_DISK_NUM) {
+		selectDisk(header.diskNum);
+	}
+
+	injectJump(header.resumeAddr);
+	entryInjected = true;
+	Uart.println(F(" Done"));
+	if (debug != DebugMode::OFF) {
+		Uart.print(F("DEBUG: Resume address = 0x"));
+		Uart.println(header.resumeAddr, HEX);
+	}
+}
+
+bool bootFromManifest() {
+	manifestName[2] = biosSettings_t.diskSet + 48;
+	bootFileOpen = false;
+	if (openSD(manifestName)) {
+		// No manifest (or no SD yet). Boot the single image file.
+		return false;
+	}
+
+	Uart.print(F("INIT: boot4 - IOS: Loading boot manifest ("));
+	Uart.print(manifestName);
+	Uart.println(F(")..."));
+	byte errCodeSD = BootManifest.load(manifestName);
+	while (errCodeSD) {
+		printErrSD(SD_OP_TYPE_READ, errCodeSD, BootManifest.lastFileName());
+		playErrorSound();
+		waitKeySD();
+		errCodeSD = BootManifest.load(manifestName);
+	}
+
+	osBank = BootManifest.entryBank();
+	injectJump(BootManifest.entryAddr());
+	entryInjected = true;
+	Uart.print(F("INIT: boot4 - IOS: Entry point bank "));
+	Uart.print(osBank);
+	Uart.print(F(" @ 0x"));
+	Uart.println(BootManifest.entryAddr(), HEX);
+	return true;
+}
+
+bool preferResidentPayload() {
+	// Use the resident copy when the SD copy is missing or unchanged. A
+	// different size means the SD copy was updated; a same size one (e.g. a
+	// patched ROM) is compared by CRC, then rewound for loading.
+	if (!bootFileOpen && (mountSD(&filesysSD) || openSD(fileNameSD))) {
+		return true;
+	}
+
+	bootFileOpen = true;
+	if (filesysSD.fsize != residentPayload.rawSize) {
+		return false;
+	}
+
+	word crc = 0;
+	byte errCodeSD;
+	do {
+		errCodeSD = readSD(bufferSD, &numReadBytes, sizeof(bufferSD));
+		for (byte i = 0; i < numReadBytes; i++) {
+			crc = _crc_xmodem_update(crc, bufferSD[i]);
 		}
+	} while ((numReadBytes == sizeof(bufferSD)) && !errCodeSD);
 
-		selBootMode = (byte)(inChar - '1');
-		Serial.print(F("DEBUG: selected boot mode: "));
-		Serial.println(selBootMode);
-		if (selBootMode <= maxBootMode) {
-			biosSettings_t.bootMode = (BootMode)selBootMode;
-			biosSettings_t.save();
+	seekSD(0);
+	return !errCodeSD && (crc == residentPayload.rawCrc);
+}
+
+void prefetchBootFile() {
+	// Runs while waiting for RUN. Mounting also probes the card type, and
+	// with the boot file already open bootStage4() can go straight to loading.
+	// On a warm boot the card is still initialized, so the saved geometry
+	// and boot file location are used if the volume is still the same.
+	bootFileOpen = false;
+	sdRemounted = false;
+	if (hwProfileValid && hwProfile_t.hasDevice(HW_DEV_SD)) {
+		filesysSD = hwProfile_t.fatfs;
+		sdRemounted = !remountSD(&filesysSD, hwProfile_t.cardType, hwProfile_t.volid);
+	}
+
+	if (!sdRemounted && mountSD(&filesysSD) && mountSD(&filesysSD)) {
+		return;
+	}
+
+	setBootModeFlags();
+	if ((byte)biosSettings_t.bootMode < (byte)BootMode::ILOAD) {
+		if (sdRemounted && !strcmp(hwProfile_t.bootFile, fileNameSD)) {
+			bootFileOpen = !pf_reopen(hwProfile_t.bootClust, hwProfile_t.bootSize);
 		}
 		else {
-			biosSettings_t.load();
+			bootFileOpen = !openSD(fileNameSD);
+		}
+	}
+}
+
+void saveHwProfile() {
+	hwProfile_t.setDevice(HW_DEV_RTC, hasRTC);
+	hwProfile_t.setDevice(HW_DEV_IOEXP, BusControl.hasIOEXP());
+	hwProfile_t.setDevice(HW_DEV_BUSCTLR, BusControl.hasBUSCTLR());
+	hwProfile_t.setDevice(HW_DEV_CARD1, BusControl.card1Present());
+	hwProfile_t.setDevice(HW_DEV_CARD2, BusControl.card2Present());
+	hwProfile_t.setDevice(HW_DEV_CARD3, BusControl.card3Present());
+	hwProfile_t.setDevice(HW_DEV_SPP, CyBorgSPP.isPresent());
+
+	DWORD volid = hwProfile_t.volid;
+	bool hasSD = (disk_cardtype() != 0) && (sdRemounted || !pf_volid(&volid));
+	hwProfile_t.setDevice(HW_DEV_SD, hasSD);
+	if (hasSD) {
+		if (!sdRemounted) {
+			hwProfile_t.cardType = disk_cardtype();
+			hwProfile_t.setFilesystem(&filesysSD);
+			hwProfile_t.volid = volid;
+		}
+
+		if (bootFileOpen) {
+			strncpy(hwProfile_t.bootFile, fileNameSD, sizeof(hwProfile_t.bootFile) - 1);
+			hwProfile_t.bootClust = filesysSD.org_clust;
+			hwProfile_t.bootSize = filesysSD.fsize;
 		}
 	}
 
-	#ifdef DEBUG
-	Serial.print(F("DEBUG: BIOS boot mode: "));
-	Serial.println((uint8_t)biosSettings_t.bootMode);
-	#endif
+	hwProfile_t.save();
+	hwProfile_t.markWarmBoot();
+}
 
-	if (biosSettings_t.bootMode == BootMode::OS_ON_SD) {
-		Serial.print(F("INIT: boot4 - IOS: Current "));
-		printOsName(biosSettings_t.diskSet);
-		Serial.println();
+void loadBootImage() {
+	const byte maxBootMode = (byte)BootMode::ILOAD;
+	if (biosSettings_t.bootMode == BootMode::RESUME) {
+		resumeFromSnapshot();
+		if (entryInjected) {
+			return;
+		}
+
+		// No usable snapshot. Fall back to iLoad for this boot only.
+		biosSettings_t.bootMode = BootMode::ILOAD;
 	}
 
 	setBootModeFlags();
-	digitalWrite(PIN_WAIT_RES, HIGH);
+	if ((biosSettings_t.bootMode == BootMode::OS_ON_SD) && bootFromManifest()) {
+		return;
+	}
+
 	if (bootStrAddr > ZERO_ADDR) {
 		loadHL(ZERO_ADDR);
 		loadByteToRAM(OPC_JP_NN);
 		loadByteToRAM(lowByte(bootStrAddr));
 		loadByteToRAM(highByte(bootStrAddr));
 		if (debug != DebugMode::OFF) {
-			Serial.print(F("DEBUG: Injected JP 0x"));
-			Serial.println(bootStrAddr, HEX);
+			Uart.print(F("DEBUG: Injected JP 0x"));
+			Uart.println(bootStrAddr, HEX);
 		}
 	}
 
 	loadHL(bootStrAddr);
 	if (debug != DebugMode::OFF) {
-		Serial.print(F("DEBUG: Flash bootImageSize = "));
-		Serial.println(bootImageSize);
-		Serial.print(F("DEBUG: bootStrAddr = "));
-		Serial.println(bootStrAddr, HEX);
+		if (hasResidentPayload) {
+			Uart.print(F("DEBUG: Flash bootImageSize = "));
+			Uart.println(residentPayload.rawSize);
+		}
+
+		Uart.print(F("DEBUG: bootStrAddr = "));
+		Uart.println(bootStrAddr, HEX);
 	}
 
 	byte errCodeSD = ERR_DSK_EMU_OK;
-	if (selBootMode < maxBootMode) {
-		if (mountSD(&filesysSD)) {
-			errCodeSD = mountSD(&filesysSD);
+	bool bootFromFlash = ((byte)biosSettings_t.bootMode >= maxBootMode);
+	if (!bootFromFlash && hasResidentPayload) {
+		bootFromFlash = preferResidentPayload();
+	}
+
+	if (!bootFromFlash) {
+		if (!bootFileOpen) {
+			// Cheap if the card is still mounted (see mountSD()).
+			if (mountSD(&filesysSD)) {
+				errCodeSD = mountSD(&filesysSD);
+				if (errCodeSD) {
+					do {
+						printErrSD(SD_OP_TYPE_MOUNT, errCodeSD, NULL);
+						playErrorSound();
+						waitKeySD();
+						mountSD(&filesysSD);
+						errCodeSD = mountSD(&filesysSD);
+					} while (errCodeSD);
+				}
+			}
+
+			errCodeSD = openSD(fileNameSD);
 			if (errCodeSD) {
 				do {
-					printErrSD(SD_OP_TYPE_MOUNT, errCodeSD, NULL);
+					printErrSD(SD_OP_TYPE_OPEN, errCodeSD, fileNameSD);
 					playErrorSound();
 					waitKeySD();
-					mountSD(&filesysSD);
-					errCodeSD = mountSD(&filesysSD);
+					errCodeSD = openSD(fileNameSD);
+					if (errCodeSD != ERR_DSK_EMU_NO_FILE) {
+						mountSD(&filesysSD);
+						mountSD(&filesysSD);
+						errCodeSD = openSD(fileNameSD);
+					}
 				} while (errCodeSD);
 			}
-		}
 
-		errCodeSD = openSD(fileNameSD);
-		if (errCodeSD) {
-			do {
-				printErrSD(SD_OP_TYPE_OPEN, errCodeSD, fileNameSD);
-				playErrorSound();
-				waitKeySD();
-				errCodeSD = openSD(fileNameSD);
-				if (errCodeSD != ERR_DSK_EMU_NO_FILE) {
-					mountSD(&filesysSD);
-					mountSD(&filesysSD);
-					errCodeSD = openSD(fileNameSD);
-				}
-			} while (errCodeSD);
+			bootFileOpen = true;
 		}
 
-		Serial.print(F("INIT: boot4 - IOS: Loading boot program ("));
-		Serial.print(fileNameSD);
-		Serial.print(F(")..."));
+		Uart.print(F("INIT: boot4 - IOS: Loading boot program ("));
+		Uart.print(fileNameSD);
+		Uart.print(F(")..."));
 		do {
 			do {
-				errCodeSD = readSD(bufferSD, &numReadBytes);
+				errCodeSD = readSD(bufferSD, &numReadBytes, sizeof(bufferSD));
 				for (iCount = 0; iCount < numReadBytes; iCount++) {
 					loadByteToRAM(bufferSD[iCount]);
 				}
-			} while ((numReadBytes == 32) && (!errCodeSD));
+			} while ((numReadBytes == sizeof(bufferSD)) && (!errCodeSD));
 
 			if (errCodeSD) {
 				printErrSD(SD_OP_TYPE_READ, errCodeSD, fileNameSD);
@@ -828,389 +1168,969 @@ void bootStage4() {
 		} while (errCodeSD);
 	}
 	else {
-		Serial.print(F("INIT: boot 4 - IOS: Loading boot program..."));
-		for (word i = 0; i < bootImageSize; i++) {
-			byte val = pgm_read_byte(bootImage + i);
-			loadByteToRAM(val);
+		Uart.print(F("INIT: boot4 - IOS: Loading resident boot program..."));
+		FlashPayload.inject(&residentPayload);
+	}
+
+	Uart.println(F(" Done"));
+}
+
+void bootStage4() {
+	// The SD card was already mounted by prefetchBootFile().
+	const byte maxBootMode = (byte)BootMode::ILOAD;
+	byte selBootMode = (byte)biosSettings_t.bootMode;
+
+	// TODO should we handle edge case scenario here where boot mode could potentially be invalid?
+	if (showBootMenu) {
+		// The menu reads the disk set names and can change the boot file.
+		bootFileOpen = false;
+		flushSerialRXBuffer();
+		Uart.println();
+		Uart.println(F("INIT: boot4 - IOS: Select boot mode or system parameters:"));
+		Uart.println();
+		Uart.print(F(" 0: No change ("));
+		Uart.print(((uint8_t)biosSettings_t.bootMode) + 1);
+		Uart.println(F(")"));
+		Uart.println(F(" 1: BASIC"));
+		Uart.println(F(" 2: Forth"));
+		Uart.print(F(" 3: Load OS from "));
+		printOsName(biosSettings_t.diskSet);
+		Uart.println(F("\r\n 4: Autoboot"));
+		Uart.println(F(" 5: iLoad"));
+		Uart.print(F(" 6: Change Z80 clock speed (->"));
+		Uart.print(biosSettings_t.clockMode == ClockMode::FAST ? CLOCK_HIGH : CLOCK_LOW);
+		Uart.println(F("MHz)"));
+		Uart.print(F(" 7: Toggle CP/M Autoexec (->"));
+		Uart.print(biosSettings_t.autoExecFlag ? F("ON") : F("OFF"));
+		Uart.println(F(")"));
+		Uart.print(F(" 8: Change "));
+		printOsName(biosSettings_t.diskSet);
+		Uart.println();
+		Uart.println(F(" 9: More settings"));
+
+		char minBootChar = '0';
+		char maxSelChar = '9';
+
+		// Ask the user to make a boot selection choice.
+		Uart.println();
+		timestamp = millis();
+		Uart.print(F("Enter your choice >"));
+		PROFILE_BEGIN(BootStep::BOOT_MENU);
+		do {
+			blinkIOSled(&timestamp);
+			inChar = Uart.read();
+		} while((inChar < minBootChar) || (inChar > maxSelChar));
+		PROFILE_END(BootStep::BOOT_MENU);
+
+		Uart.print(inChar);
+		Uart.println(F(" OK"));
+
+		switch (inChar) {
+			case '6':
+				handleToggleClockMode();
+				break;
+			case '7':
+				handleToggleAutoExecFlag();
+				break;
+			case '8':
+				handleChangeDiskSet();
+				break;
+			case '9':
+				handleMoreSettings();
+				break;
+			default:
+				break;
+		}
+
+		selBootMode = (byte)(inChar - '1');
+		Uart.print(F("DEBUG: selected boot mode: "));
+		Uart.println(selBootMode);
+		if (selBootMode <= maxBootMode) {
+			biosSettings_t.bootMode = (BootMode)selBootMode;
+			biosSettings_t.save();
 		}
+		else {
+			biosSettings_t.load();
+		}
+	}
+
+	#ifdef DEBUG
+	Uart.print(F("DEBUG: BIOS boot mode: "));
+	Uart.println((uint8_t)biosSettings_t.bootMode);
+	#endif
+
+	if (biosSettings_t.bootMode == BootMode::OS_ON_SD) {
+		Uart.print(F("INIT: boot4 - IOS: Current "));
+		printOsName(biosSettings_t.diskSet);
+		Uart.println();
 	}
 
-	Serial.println(F(" Done"));
+	digitalWrite(PIN_WAIT_RES, HIGH);
+	PROFILE_BEGIN(BootStep::IMAGE_LOAD);
+	loadBootImage();
+	PROFILE_END(BootStep::IMAGE_LOAD);
+	saveHwProfile();
 }
 
 void bootStage5() {
 	// TODO Show summary screen?
 	// TODO BIOS version, RTC presence, IOEXP presence, CPU speed, RAM, etc.
-	if (!showBootMenu && biosSettings_t.enableStartupJingle) {
-		playStartupJingle();
+	// The jingle has been playing in the background since stage 1. It must
+	// be over before the Z80 runs, as the Z80 owns the speaker from then on.
+	awaitStartupJingle();
+
+	// The Z80 already sits on an injected jump (resume or manifest boot), so
+	// it must not be reset.
+	if (!entryInjected) {
+		digitalWrite(PIN_RESET, LOW);
 	}
 
-	digitalWrite(PIN_RESET, LOW);
-	ASSR &= ~(1 << AS2);
-	TCCR2 |= (1 << CS20);
-	TCCR2 &= ~((1 << CS21) | (1 << CS22));
-	TCCR2 |= (1 << WGM21);
-	TCCR2 &= ~(1 << WGM20);
-	TCCR2 |= (1 << COM20);
-	TCCR2 &= ~(1 << COM21);
-	OCR2 = (byte)biosSettings_t.clockMode;
-	
-	pinMode(PIN_CLK, OUTPUT);
-	Serial.println(F("INIT: boot5 - IOS: Z80 CPU running"));
-	Serial.println();
+	startZ80Clock((byte)biosSettings_t.clockMode);
+	Uart.println(F("INIT: boot5 - IOS: Z80 CPU running"));
+	Uart.println();
 	flushSerialRXBuffer();
 
-	delay(1);
-	digitalWrite(PIN_RESET, HIGH);
+	if (!entryInjected) {
+		delay(1);
+		digitalWrite(PIN_RESET, HIGH);
+	}
 }
 
 void setup() {
+	PROFILE_BEGIN(BootStep::STAGE0);
 	bootStage0();
+
+	// Settings, I2C discovery and the SD/boot file lookup don't depend on
+	// the rest of the system, so they run while waiting for RUN.
+	PROFILE_BEGIN(BootStep::STAGE3);
+	bootStage3();
+	prefetchBootFile();
+	PROFILE_END(BootStep::STAGE3);
+	awaitRunTrigger();
+	PROFILE_END(BootStep::STAGE0);
+	PROFILE_BEGIN(BootStep::STAGE1);
 	bootStage1();
+	PROFILE_END(BootStep::STAGE1);
+	PROFILE_BEGIN(BootStep::STAGE2);
 	bootStage2();
-	bootStage3();
+	PROFILE_END(BootStep::STAGE2);
+	PROFILE_BEGIN(BootStep::STAGE4);
 	bootStage4();
+	PROFILE_END(BootStep::STAGE4);
+	PROFILE_BEGIN(BootStep::STAGE5);
 	bootStage5();
+	PROFILE_END(BootStep::STAGE5);
+	#ifdef BOOT_PROFILER
+	BootProfiler.finish();
+	#endif
 }
 
-void loop() {
-	if (!digitalRead(PIN_WAIT)) {
-		// I/O Operation requested
-		if (!digitalRead(PIN_WR)) {
-			// I/O Write Operation requested.
-			ioAddress = digitalRead(PIN_AD0);
-			ioData = PINA;
-			if (ioAddress) {
-				// STORE opcode
-				ioOpCode = ioData;
-				ioByteCount = 0;
-			}
-			else {
-				// EXECUTE opcode
-				switch (ioOpCode) {
-					case OP_IO_WR_USR_LED:
-						digitalWrite(PIN_USER, (ioData & B00000001) ? LOW : HIGH);
-						break;
-					case OP_IO_WR_SER_TX:
-						Serial.write(ioData);
-						break;
-					case OP_IO_WR_GPIOA:
-						BusControl.writeGPIOA(ioData);
-						break;
-					case OP_IO_WR_GPIOB:
-						BusControl.writeGPIOB(ioData);
-						break;
-					case OP_IO_WR_IODIRA:
-						BusControl.writeIODirA(ioData);
-						break;
-					case OP_IO_WR_IODIRB:
-						BusControl.writeIODirB(ioData);
-						break;
-					case OP_IO_WR_GPPUA:
-						BusControl.writeGPPUA(ioData);
-						break;
-					case OP_IO_WR_GPPUB:
-						BusControl.writeGPPUB(ioData);
-						break;
-					case OP_IO_WR_SELDSK:
-						if (ioData <= MAX_DISK_NUM) {
-							diskName[2] = biosSettings_t.diskSet + 48;
-							diskName[4] = (ioData / 10) + 48;
-							diskName[5] = ioData - ((ioData / 10) * 10) + 48;
-							diskErr = openSD(diskName);
-						}
-						else {
-							diskErr = ERR_DSK_EMU_ILLEGAL_DSK_NUM;
-						}
-						break;
-					case OP_IO_WR_SELTRK:
-						if (!ioByteCount) {
-							// LSB
-							trackSel = ioData;
-						}
-						else {
-							// MSB
-							trackSel = (((word)ioData) << 8) | lowByte(trackSel);
-							if ((trackSel < MAX_TRACKS) && (sectSel < MAX_SECTORS)) {
-								diskErr = ERR_DSK_EMU_OK;
-							}
-							else {
-								if (sectSel < MAX_SECTORS) {
-									diskErr = ERR_DSK_EMU_ILLEGAL_TRK_NUM;
-								}
-								else {
-									diskErr = ERR_DSK_EMU_ILLEGAL_SCT_NUM;
-								}
-							}
-							ioOpCode = OP_IO_NOP;
-						}
+void ioWrUsrLed() {
+	digitalWrite(PIN_USER, (ioData & B00000001) ? LOW : HIGH);
+}
 
-						ioByteCount++;
-						break;
-					case OP_IO_WR_SELSCT:
-						sectSel = ioData;
-						if ((trackSel < MAX_TRACKS) && (sectSel < MAX_SECTORS)) {
-							diskErr = ERR_DSK_EMU_OK;
-						}
-						else {
-							if (sectSel < MAX_SECTORS) {
-								diskErr = ERR_DSK_EMU_ILLEGAL_TRK_NUM;
-							}
-							else {
-								diskErr = ERR_DSK_EMU_ILLEGAL_SCT_NUM;
-							}
-						}
-						break;
-					case OP_IO_WR_WRTSCT:
-						if (!ioByteCount) {
-							if ((trackSel < MAX_TRACKS) && (sectSel < MAX_SECTORS) && (!diskErr)) {
-								diskErr = seekSD((trackSel << 5) | sectSel);
-							}
-						}
+void ioWrSerTx() {
+	Uart.write(ioData);
+}
 
-						if (!diskErr) {
-							tempByte = ioByteCount % MAX_SECTORS;
-							bufferSD[tempByte] = ioData;
-							if (tempByte == (MAX_SECTORS - 1)) {
-								diskErr = writeSD(bufferSD, &numWriBytes);
-								if (numWriBytes < MAX_SECTORS) {
-									diskErr = ERR_DSK_EMU_UNEXPECTED_EOF;
-								}
+void ioWrGpioA() {
+	BusControl.writeGPIOA(ioData);
+}
 
-								if (ioByteCount >= (MAX_TRACKS - 1)) {
-									if (!diskErr) {
-										diskErr = writeSD(NULL, &numWriBytes);
-									}
+void ioWrGpioB() {
+	BusControl.writeGPIOB(ioData);
+}
 
-									ioOpCode = OP_IO_NOP;
-								}
-							}
-						}
+void ioWrGpioAB() {
+	static byte gpioA;
+	if (!ioByteCount) {
+		gpioA = ioData;
+	}
+	else {
+		BusControl.writeGPIOAB(word(ioData, gpioA));
+	}
+}
 
-						ioByteCount++;
-						break;
-					case OP_IO_WR_SETBNK:
-						switch (ioData) {
-							case OS_MEM_BANK_0:
-								// Set physical bank 0 (logical bank 1)
-								digitalWrite(PIN_BANK0, HIGH);
-								digitalWrite(PIN_BANK1, LOW);
-								break;
-							case OS_MEM_BANK_1:
-								digitalWrite(PIN_BANK0, HIGH);
-								digitalWrite(PIN_BANK1, HIGH);
-								break;
-							case OS_MEM_BANK_2:
-								digitalWrite(PIN_BANK0, LOW);
-								digitalWrite(PIN_BANK1, HIGH);
-								break;
-							default:
-								break;
-						}
-						break;
-					case OP_IO_WR_SETIRQ:
-						z80IntEnFlag = (bool)(ioData & 1);
-						z80IntSysTick = (bool)(ioData & (1 << 1)) >> 1;
-						break;
-					case OP_IO_WR_SETTICK:
-						if (ioData > 0) {
-							sysTickTime = ioData;
-						}
-						break;
-					case OP_IO_WR_BEEPSTART:
-						// TODO Support frequencies higher than 255 by allowing for a 4 byte exchange to get
-						// a full integer.
-						pcSpk.buzz(ioData, 0UL);
-						break;
-					case OP_IO_WR_BEEPSTOP:
-						pcSpk.off();
-						break;
-					case OP_SPP_WR_INIT:
-						CyBorgSPP.init(ioData);
-						break;
-					case OP_SPP_WR_WRITE:
-						CyBorgSPP.write(ioData);
-						break;
-					default:
-						break;
-				}
+void ioWrGpioASet() {
+	BusControl.setGPIOBits(GPIO_PORT_A, ioData);
+}
 
-				if ((ioOpCode != OP_IO_WR_SELTRK) && (ioOpCode != OP_IO_WR_WRTSCT)) {
-					ioOpCode = OP_IO_NOP;
-				}
-			}
+void ioWrGpioAClr() {
+	BusControl.clearGPIOBits(GPIO_PORT_A, ioData);
+}
+
+void ioWrGpioATgl() {
+	BusControl.toggleGPIOBits(GPIO_PORT_A, ioData);
+}
+
+void ioWrGpioBSet() {
+	BusControl.setGPIOBits(GPIO_PORT_B, ioData);
+}
+
+void ioWrGpioBClr() {
+	BusControl.clearGPIOBits(GPIO_PORT_B, ioData);
+}
+
+void ioWrGpioBTgl() {
+	BusControl.toggleGPIOBits(GPIO_PORT_B, ioData);
+}
+
+void ioWrGpioWatch() {
+	static byte maskA;
+	if (!ioByteCount) {
+		maskA = ioData;
+	}
+	else {
+		BusControl.setInputWatch(word(ioData, maskA));
+	}
+}
+
+void ioWrIoDirA() {
+	BusControl.writeIODirA(ioData);
+}
+
+void ioWrIoDirB() {
+	BusControl.writeIODirB(ioData);
+}
+
+void ioWrGppuA() {
+	BusControl.writeGPPUA(ioData);
+}
+
+void ioWrGppuB() {
+	BusControl.writeGPPUB(ioData);
+}
+
+void ioWrSelDsk() {
+	if (ioData <= MAX_DISK_NUM) {
+		selectDisk(ioData);
+	}
+	else {
+		diskErr = ERR_DSK_EMU_ILLEGAL_DSK_NUM;
+	}
+}
 
-			exitWaitState();
+void checkTrackSector() {
+	if ((trackSel < MAX_TRACKS) && (sectSel < MAX_SECTORS)) {
+		diskErr = ERR_DSK_EMU_OK;
+	}
+	else {
+		if (sectSel < MAX_SECTORS) {
+			diskErr = ERR_DSK_EMU_ILLEGAL_TRK_NUM;
 		}
-		else if (!digitalRead(PIN_RD)) {
-			// I/O Read operaion requested.
-			ioAddress = digitalRead(PIN_AD0);
-			ioData = 0;
-			if (ioAddress) {
-				// AD0 = 1 (I/O Read Address = 0x01). We're reading Serial RX.
-				ioData = OP_IO_NOP;
-				if (Serial.available() > 0) {
-					ioData = Serial.read();
-					lastRxIsEmpty = false;
-				}
-				else {
-					lastRxIsEmpty = true;
-				}
+		else {
+			diskErr = ERR_DSK_EMU_ILLEGAL_SCT_NUM;
+		}
+	}
+}
+
+void ioWrSelTrk() {
+	if (!ioByteCount) {
+		// LSB
+		trackSel = ioData;
+	}
+	else {
+		// MSB
+		trackSel = (((word)ioData) << 8) | lowByte(trackSel);
+		checkTrackSector();
+	}
+}
+
+void ioWrSelSct() {
+	sectSel = ioData;
+	checkTrackSector();
+}
+
+void ioWrWrtSct() {
+	if (!ioByteCount) {
+		if ((trackSel < MAX_TRACKS) && (sectSel < MAX_SECTORS) && (!diskErr)) {
+			diskErr = seekSD((trackSel << 5) | sectSel);
+		}
+	}
 
-				digitalWrite(PIN_INT, HIGH);
-				irqStatus &= B11111110;
+	if (!diskErr) {
+		tempByte = ioByteCount % SD_DISK_BUFFER_SIZE;
+		bufferSD[tempByte] = ioData;
+		if (tempByte == (SD_DISK_BUFFER_SIZE - 1)) {
+			diskErr = writeSD(bufferSD, &numWriBytes, SD_DISK_BUFFER_SIZE);
+			if (numWriBytes < SD_DISK_BUFFER_SIZE) {
+				diskErr = ERR_DSK_EMU_UNEXPECTED_EOF;
 			}
-			else {
-				// AD0 = 0 (I/O Read address = 0x00). Execute read OpCode.
-				switch (ioOpCode) {
-					case OP_IO_RD_USRKEY:
-						tempByte = digitalRead(PIN_USER);
-						pinMode(PIN_USER, INPUT_PULLUP);
-						ioData = !digitalRead(PIN_USER);
-						pinMode(PIN_USER, OUTPUT);
-						digitalWrite(PIN_USER, tempByte);
-						break;
-					case OP_IO_RD_GPIOA:
-						if (BusControl.hasIOEXP()) {
-							ioData = BusControl.readGPIOA();
-						}
-						break;
-					case OP_IO_RD_GPIOB:
-						if (BusControl.hasIOEXP()) {
-							ioData = BusControl.readGPIOB();
-						}
-						break;
-					case OP_IO_RD_SYSFLG:
-						ioData = biosSettings_t.autoExecFlag
-							| ((byte)hasRTC << 1)
-							| ((Serial.available() > 0) << 2)
-							| ((lastRxIsEmpty > 0) << 3);
-						break;
-					case OP_IO_RD_DATTME:
-						if (hasRTC) {
-							if (ioByteCount == 0) {
-								RTC.update();
-							}
 
-							if (ioByteCount < 7) {
-								switch (ioByteCount) {
-									case 0:
-										ioData = RTC.dateTime->seconds;
-										break;
-									case 1:
-										ioData = RTC.dateTime->minutes;
-										break;
-									case 2:
-										ioData = RTC.dateTime->hours;
-										break;
-									case 3:
-										ioData = RTC.dateTime->day;
-										break;
-									case 4:
-										ioData = RTC.dateTime->month;
-										break;
-									case 5:
-										ioData = RTC.dateTime->year;
-										break;
-									case 6:
-										ioData = RTC.dateTime->tempC;
-										break;
-									default:
-										break;
-								}
+			if ((ioByteCount >= (SD_SECTOR_SIZE - 1)) && !diskErr) {
+				diskErr = writeSD(NULL, &numWriBytes);
+			}
+		}
+	}
+}
 
-								ioByteCount++;
-							}
-							else {
-								ioOpCode = OP_IO_NOP;
-							}
-						}
-						else {
-							ioOpCode = OP_IO_NOP;
-						}
-						break;
-					case OP_IO_RD_ERRDSK:
-						ioData = diskErr;
-						break;
-					case OP_IO_RD_RDSECT:
-						if (!ioByteCount && (trackSel < MAX_TRACKS) && (sectSel < MAX_SECTORS) && !diskErr) {
-							diskErr = seekSD((trackSel << 5) | sectSel);
-						}
+void ioWrSetBnk() {
+	if (ioData <= OS_MEM_BANK_2) {
+		setOsBank(ioData);
+		osBank = ioData;
+	}
+}
 
-						if (!diskErr) {
-							tempByte = ioByteCount % MAX_SECTORS;
-							if (!tempByte) {
-								diskErr = readSD(bufferSD, &numReadBytes);
-								if (numReadBytes < MAX_SECTORS) {
-									diskErr = ERR_DSK_EMU_UNEXPECTED_EOF;
-								}
-							}
+void ioWrSetIrq() {
+	z80IntEnFlag = (bool)(ioData & 1);
+	z80IntSysTick = (bool)(ioData & (1 << 1));
+	z80IntGpio = (bool)(ioData & (1 << 2));
+	z80IntSlots = (bool)(ioData & (1 << 3));
+}
 
-							if (!diskErr) {
-								ioData = bufferSD[tempByte];
-							}
-						}
+void ioWrSetTick() {
+	if (ioData > 0) {
+		sysTickTime = ioData;
+	}
+}
 
-						if (ioByteCount >= (MAX_TRACKS - 1)) {
-							ioOpCode = OP_IO_NOP;
-						}
+void ioWrBeepStart() {
+	// TODO Support frequencies higher than 255 by allowing for a 4 byte exchange to get
+	// a full integer.
+	pcSpk.buzz(ioData, 0UL);
+}
 
-						ioByteCount++;
-						break;
-					case OP_IO_RD_SDMNT:
-						ioData = mountSD(&filesysSD);
-						break;
-					case OP_IO_RD_ATXBUFF:
-						ioData = Serial.availableForWrite();
-						break;
-					case OP_IO_RD_SYSIRQ:
-						ioData = irqStatus;
-						irqStatus = 0;
-						break;
-					case OP_SPP_RD_READ:
-						if (CyBorgSPP.isPresent()) {
-							ioData = CyBorgSPP.read();
-						}
-						break;
-					default:
-						break;
-				}
+void ioWrBeepStop() {
+	pcSpk.off();
+}
 
-				if ((ioOpCode != OP_IO_RD_DATTME) && (ioOpCode != OP_IO_RD_RDSECT)) {
-					ioOpCode = OP_IO_NOP;
-				}
+void ioWrSppInit() {
+	CyBorgSPP.init(ioData);
+}
+
+void ioWrSppWrite() {
+	CyBorgSPP.write(ioData);
+}
+
+void ioWrSetBaud() {
+	BaudRate rate = (BaudRate)(ioData & B01111111);
+	if ((rate > MAX_BAUD_RATE) || (rate == currentBaudRate)) {
+		return;
+	}
+
+	if (!baudSwitchPending) {
+		previousBaudRate = currentBaudRate;
+	}
+
+	baudSwitchSave = (bool)(ioData & B10000000);
+	switchBaudRate(rate);
+	baudSwitchPending = true;
+	baudSwitchTime = millis();
+}
+
+void ioWrHibernate() {
+	if (!ioByteCount) {
+		// LSB
+		hibernateAddr = ioData;
+	}
+	else {
+		// MSB
+		hibernateAddr = (((word)ioData) << 8) | lowByte(hibernateAddr);
+		hibernateRequested = true;
+	}
+}
+
+void ioRdUsrKey() {
+	tempByte = digitalRead(PIN_USER);
+	pinMode(PIN_USER, INPUT_PULLUP);
+	ioData = !digitalRead(PIN_USER);
+	pinMode(PIN_USER, OUTPUT);
+	digitalWrite(PIN_USER, tempByte);
+}
+
+void ioRdGpioA() {
+	if (BusControl.hasIOEXP()) {
+		ioData = BusControl.readGPIOA();
+	}
+}
+
+void ioRdGpioB() {
+	if (BusControl.hasIOEXP()) {
+		ioData = BusControl.readGPIOB();
+	}
+}
+
+void ioRdGpioAB() {
+	static byte gpioB;
+	if (!ioByteCount) {
+		word gpio = BusControl.readGPIOAB();
+		ioData = lowByte(gpio);
+		gpioB = highByte(gpio);
+	}
+	else {
+		ioData = gpioB;
+	}
+}
+
+void ioRdSlots() {
+	ioData = BusControl.slotMask();
+}
+
+void ioRdSysFlg() {
+	ioData = biosSettings_t.autoExecFlag
+		| ((byte)hasRTC << 1)
+		| ((Uart.available() > 0) << 2)
+		| ((lastRxIsEmpty > 0) << 3)
+		| ((byte)Uart.isTxFull() << 4);
+}
+
+void ioRdDatTme() {
+	if (!hasRTC) {
+		ioOpCode = OP_IO_NOP;
+		return;
+	}
+
+	if (ioByteCount == 0) {
+		RTC.update();
+	}
+
+	switch (ioByteCount) {
+		case 0:
+			ioData = RTC.dateTime->seconds;
+			break;
+		case 1:
+			ioData = RTC.dateTime->minutes;
+			break;
+		case 2:
+			ioData = RTC.dateTime->hours;
+			break;
+		case 3:
+			ioData = RTC.dateTime->day;
+			break;
+		case 4:
+			ioData = RTC.dateTime->month;
+			break;
+		case 5:
+			ioData = RTC.dateTime->year;
+			break;
+		case 6:
+			ioData = RTC.dateTime->tempC;
+			break;
+		default:
+			break;
+	}
+}
+
+void ioRdErrDsk() {
+	ioData = diskErr;
+}
+
+void ioRdRdSect() {
+	if (!ioByteCount && (trackSel < MAX_TRACKS) && (sectSel < MAX_SECTORS) && !diskErr) {
+		diskErr = seekSD((trackSel << 5) | sectSel);
+	}
+
+	if (!diskErr) {
+		tempByte = ioByteCount % SD_DISK_BUFFER_SIZE;
+		if (!tempByte) {
+			diskErr = readSD(bufferSD, &numReadBytes, SD_DISK_BUFFER_SIZE);
+			if (numReadBytes < SD_DISK_BUFFER_SIZE) {
+				diskErr = ERR_DSK_EMU_UNEXPECTED_EOF;
 			}
+		}
 
-			DDRA = OP_IO_NOP;  // Configure Z80 data bus D0 - D7 (PA0 - PA7) as output
-			PORTA = ioData;    // Write to data bus.
-
-			// Bus control to exit from wait state (M I/O read cycle)
-			digitalWrite(PIN_BUSREQ, LOW);     // Request DMA
-			digitalWrite(PIN_WAIT_RES, LOW);   // Now safe reset WAIT FF (exit wait state)
-			delayMicroseconds(2);              // Wait 2us to be sure Z80 read the data and go Hi-Z
-			DDRA = 0x00;                       // Configure Z80 data bus as input with pullup
-			PORTA = 0xFF;
-			digitalWrite(PIN_WAIT_RES, HIGH);  // Now Z80 is in DMA (Hi-Z), so safe to set WAIT_RES HIGH again
-			digitalWrite(PIN_BUSREQ, HIGH);    // Resume Z80 from DMA.
+		if (!diskErr) {
+			ioData = bufferSD[tempByte];
+		}
+	}
+}
+
+void ioRdSdMnt() {
+	ioData = mountSD(&filesysSD);
+}
+
+void ioRdATxBuff() {
+	ioData = Uart.availableForWrite();
+}
+
+/**
+ * @brief Serves a stats read OpCode one byte per read, from a snapshot taken
+ * on the first byte so the counters don't change halfway through.
+ *
+ * @param readStats Returns the current counters.
+ */
+template <typename Stats>
+void ioRdStats(Stats (*readStats)()) {
+	static Stats stats;
+	if (!ioByteCount) {
+		stats = readStats();
+	}
+
+	ioData = ((const byte*)&stats)[ioByteCount];
+}
+
+UartStats readUartStats() {
+	return Uart.stats();
+}
+
+TwiStats readTwiStats() {
+	return TwiBus.stats();
+}
+
+void ioRdUartStat() {
+	ioRdStats(readUartStats);
+}
+
+void ioRdI2cStat() {
+	ioRdStats(readTwiStats);
+}
+
+void ioRdSysIrq() {
+	ioData = irqStatus;
+	irqStatus = 0;
+}
+
+void ioRdSppRead() {
+	if (CyBorgSPP.isPresent()) {
+		ioData = CyBorgSPP.read();
+	}
+}
+
+void ioRdBootRep() {
+	#ifdef BOOT_PROFILER
+	if (ioByteCount < BootProfiler.reportSize()) {
+		ioData = BootProfiler.reportByte(ioByteCount);
+		return;
+	}
+	#endif
+
+	ioOpCode = OP_IO_NOP;
+}
+
+/**
+ * @brief The OpCode registry: handler and byte count of every implemented
+ * OpCode. New OpCodes only need a line here. The dispatch tables below are
+ * generated from it at compile time.
+ */
+constexpr IoOpcode ioOpcodeEntry(byte opCode) {
+	return
+		IO_OPCODE(OP_IO_WR_USR_LED, ioWrUsrLed, IO_STREAMING)
+		IO_OPCODE(OP_IO_WR_SER_TX, ioWrSerTx, IO_STREAMING)
+		IO_OPCODE(OP_IO_WR_GPIOA, ioWrGpioA, IO_STREAMING)
+		IO_OPCODE(OP_IO_WR_GPIOB, ioWrGpioB, IO_STREAMING)
+		IO_OPCODE(OP_IO_WR_GPIOAB, ioWrGpioAB, 2)
+		IO_OPCODE(OP_IO_WR_GPIOA_SET, ioWrGpioASet, IO_STREAMING)
+		IO_OPCODE(OP_IO_WR_GPIOA_CLR, ioWrGpioAClr, IO_STREAMING)
+		IO_OPCODE(OP_IO_WR_GPIOA_TGL, ioWrGpioATgl, IO_STREAMING)
+		IO_OPCODE(OP_IO_WR_GPIOB_SET, ioWrGpioBSet, IO_STREAMING)
+		IO_OPCODE(OP_IO_WR_GPIOB_CLR, ioWrGpioBClr, IO_STREAMING)
+		IO_OPCODE(OP_IO_WR_GPIOB_TGL, ioWrGpioBTgl, IO_STREAMING)
+		IO_OPCODE(OP_IO_WR_GPIOWATCH, ioWrGpioWatch, 2)
+		IO_OPCODE(OP_IO_WR_IODIRA, ioWrIoDirA, 1)
+		IO_OPCODE(OP_IO_WR_IODIRB, ioWrIoDirB, 1)
+		IO_OPCODE(OP_IO_WR_GPPUA, ioWrGppuA, 1)
+		IO_OPCODE(OP_IO_WR_GPPUB, ioWrGppuB, 1)
+		IO_OPCODE(OP_IO_WR_SELDSK, ioWrSelDsk, 1)
+		IO_OPCODE(OP_IO_WR_SELTRK, ioWrSelTrk, 2)
+		IO_OPCODE(OP_IO_WR_SELSCT, ioWrSelSct, 1)
+		IO_OPCODE(OP_IO_WR_WRTSCT, ioWrWrtSct, SD_SECTOR_SIZE)
+		IO_OPCODE(OP_IO_WR_SETBNK, ioWrSetBnk, 1)
+		IO_OPCODE(OP_IO_WR_SETIRQ, ioWrSetIrq, 1)
+		IO_OPCODE(OP_IO_WR_SETTICK, ioWrSetTick, 1)
+		IO_OPCODE(OP_SPP_WR_INIT, ioWrSppInit, 1)
+		IO_OPCODE(OP_SPP_WR_WRITE, ioWrSppWrite, IO_STREAMING)
+		IO_OPCODE(OP_IO_WR_BEEPSTART, ioWrBeepStart, 1)
+		IO_OPCODE(OP_IO_WR_BEEPSTOP, ioWrBeepStop, 1)
+		IO_OPCODE(OP_IO_WR_HIBERNATE, ioWrHibernate, 2)
+		IO_OPCODE(OP_IO_WR_SETBAUD, ioWrSetBaud, 1)
+		IO_OPCODE(OP_IO_RD_USRKEY, ioRdUsrKey, 1)
+		IO_OPCODE(OP_IO_RD_GPIOA, ioRdGpioA, 1)
+		IO_OPCODE(OP_IO_RD_GPIOB, ioRdGpioB, 1)
+		IO_OPCODE(OP_IO_RD_GPIOAB, ioRdGpioAB, 2)
+		IO_OPCODE(OP_IO_RD_SLOTS, ioRdSlots, 1)
+		IO_OPCODE(OP_IO_RD_SYSFLG, ioRdSysFlg, 1)
+		IO_OPCODE(OP_IO_RD_DATTME, ioRdDatTme, 7)
+		IO_OPCODE(OP_IO_RD_ERRDSK, ioRdErrDsk, 1)
+		IO_OPCODE(OP_IO_RD_RDSECT, ioRdRdSect, SD_SECTOR_SIZE)
+		IO_OPCODE(OP_IO_RD_SDMNT, ioRdSdMnt, 1)
+		IO_OPCODE(OP_IO_RD_ATXBUFF, ioRdATxBuff, 1)
+		IO_OPCODE(OP_IO_RD_SYSIRQ, ioRdSysIrq, 1)
+		IO_OPCODE(OP_IO_RD_UARTSTAT, ioRdUartStat, sizeof(UartStats))
+		IO_OPCODE(OP_IO_RD_I2CSTAT, ioRdI2cStat, sizeof(TwiStats))
+		IO_OPCODE(OP_SPP_RD_READ, ioRdSppRead, 1)
+		IO_OPCODE(OP_IO_RD_BOOTREP, ioRdBootRep, IO_OPEN_ENDED)
+		IO_OPCODE_END;
+}
+
+const IoOpcode ioWriteTable[IO_OPCODE_TABLE_SIZE] PROGMEM = {
+	IO_TABLE_64(ioOpcodeEntry, IO_WR_OPCODE_BASE)
+};
+
+const IoOpcode ioReadTable[IO_OPCODE_TABLE_SIZE] PROGMEM = {
+	IO_TABLE_64(ioOpcodeEntry, IO_RD_OPCODE_BASE)
+};
+
+/**
+ * @brief Card register lookup of the SPP card (write registers 0x00 - 0x0F,
+ * read registers 0x80 - 0x8F).
+ */
+constexpr IoOpcode sppSlotEntry(byte opCode) {
+	return
+		IO_OPCODE(SLOT_SPP_WR_INIT, ioWrSppInit, 1)
+		IO_OPCODE(SLOT_SPP_WR_WRITE, ioWrSppWrite, IO_STREAMING)
+		IO_OPCODE(0x80 | SLOT_SPP_RD_READ, ioRdSppRead, 1)
+		IO_OPCODE_END;
+}
+
+const IoSlotCard sppSlotCard PROGMEM = {
+	{IO_TABLE_16(sppSlotEntry, 0x00)},
+	{IO_TABLE_16(sppSlotEntry, 0x80)}
+};
+
+/**
+ * @brief Attaches the known cards to their slot (slot OpCodes).
+ */
+void registerSlotCards() {
+	memset(ioSlotCards, 0, sizeof(ioSlotCards));
+	if (CyBorgSPP.isPresent() && (sppSlot != IO_SLOT_NONE)) {
+		ioSlotCards[sppSlot] = &sppSlotCard;
+	}
+}
+
+/**
+ * @brief Finds the slot of each known card and attaches it. Toggles the CEN
+ * lines of the cards (BusControl.findCardSlot()), so it only runs at boot,
+ * while the Z80 is held.
+ */
+void findSlotCards() {
+	sppSlot = IO_SLOT_NONE;
+	if (CyBorgSPP.isPresent()) {
+		sppSlot = BusControl.findCardSlot(SPP_ADDR);
+	}
+
+	registerSlotCards();
+}
+
+/**
+ * @brief Updates the slot of each known card after the cards changed,
+ * without touching the CEN lines of live cards: a card keeps its slot while
+ * that slot holds a card, and a card found with no other card present owns
+ * the only slot in use. Otherwise its slot stays unknown (no slot OpCodes)
+ * until the next boot.
+ */
+void updateSlotCards() {
+	if (!CyBorgSPP.isPresent()) {
+		sppSlot = IO_SLOT_NONE;
+	}
+	else if ((sppSlot == IO_SLOT_NONE) || !bitRead(BusControl.slotMask(), sppSlot)) {
+		sppSlot = BusControl.onlyCardSlot();
+	}
+
+	registerSlotCards();
+}
+
+/**
+ * @brief Runs the handler of the current OpCode for one byte and ends the
+ * OpCode (ioOpCode = OP_IO_NOP) once all its bytes were exchanged.
+ *
+ * @param entry The dispatch table entry of the OpCode (PROGMEM).
+ */
+void dispatchOpcode(const IoOpcode* entry) {
+	IoHandler handler = (IoHandler)pgm_read_word(&entry->handler);
+	if (handler == NULL) {
+		ioOpCode = OP_IO_NOP;
+		return;
+	}
+
+	handler();
+	ioByteCount++;
+	word byteCount = pgm_read_word(&entry->byteCount);
+	if ((byteCount != IO_OPEN_ENDED) && (ioByteCount >= byteCount)) {
+		ioOpCode = OP_IO_NOP;
+	}
+}
+
+/**
+ * @brief Runs a slot OpCode through the tables of the card in the slot.
+ *
+ * @param index The OpCode offset in the slot window (slot * 16 + register).
+ * @param read true for a read OpCode.
+ */
+void dispatchSlotOpcode(byte index, bool read) {
+	const IoSlotCard* card = ioSlotCards[index >> 4];
+	if (card == NULL) {
+		ioOpCode = OP_IO_NOP;
+		return;
+	}
+
+	byte reg = index & (IO_SLOT_REGS - 1);
+	dispatchOpcode(read ? &card->read[reg] : &card->write[reg]);
+}
+
+/**
+ * @brief Services an I/O write request (the Z80 is in WAIT).
+ *
+ * @param ad0 The state of AD0 (1 = store opcode, 0 = execute opcode).
+ */
+void serviceIoWrite(byte ad0) {
+	ioAddress = ad0;
+	ioData = PINA;
+	if (ioAddress) {
+		// STORE opcode
+		ioOpCode = ioData;
+		ioByteCount = 0;
+	}
+	else if (ioOpCode < (IO_WR_OPCODE_BASE + IO_OPCODE_TABLE_SIZE)) {
+		// EXECUTE opcode
+		dispatchOpcode(&ioWriteTable[ioOpCode - IO_WR_OPCODE_BASE]);
+	}
+	else if ((ioOpCode >= IO_SLOT_WR_OPCODE_BASE) && (ioOpCode < (IO_SLOT_WR_OPCODE_BASE + (IO_SLOT_COUNT * IO_SLOT_REGS)))) {
+		dispatchSlotOpcode(ioOpCode - IO_SLOT_WR_OPCODE_BASE, false);
+	}
+
+	exitWaitState();
+	if (hibernateRequested) {
+		// The Z80 is expected to HALT right after the last byte.
+		hibernateRequested = false;
+		hibernateZ80();
+	}
+}
+
+/**
+ * @brief Services an I/O read request (the Z80 is in WAIT).
+ *
+ * @param ad0 The state of AD0 (1 = serial RX, 0 = execute opcode).
+ */
+void serviceIoRead(byte ad0) {
+	ioAddress = ad0;
+	ioData = 0;
+	if (ioAddress) {
+		// AD0 = 1 (I/O Read Address = 0x01). We're reading Serial RX.
+		ioData = OP_IO_NOP;
+		if (Uart.available() > 0) {
+			ioData = Uart.read();
+			lastRxIsEmpty = false;
 		}
 		else {
-			digitalWrite(PIN_INT, HIGH);
+			lastRxIsEmpty = true;
+		}
+
+		// Keep /INT asserted while other IRQs are still pending.
+		irqStatus &= B11111110;
+		if (!irqStatus) {
+			FastPin<PIN_INT>::high();
+		}
+	}
+	else if ((ioOpCode >= IO_RD_OPCODE_BASE) && (ioOpCode < (IO_RD_OPCODE_BASE + IO_OPCODE_TABLE_SIZE))) {
+		// AD0 = 0 (I/O Read address = 0x00). Execute read OpCode.
+		dispatchOpcode(&ioReadTable[ioOpCode - IO_RD_OPCODE_BASE]);
+	}
+	else if ((ioOpCode >= IO_SLOT_RD_OPCODE_BASE) && (ioOpCode < (IO_SLOT_RD_OPCODE_BASE + (IO_SLOT_COUNT * IO_SLOT_REGS)))) {
+		dispatchSlotOpcode(ioOpCode - IO_SLOT_RD_OPCODE_BASE, true);
+	}
+
+	DDRA = OP_IO_NOP;  // Configure Z80 data bus D0 - D7 (PA0 - PA7) as output
+	PORTA = ioData;    // Write to data bus.
+
+	// Bus control to exit from wait state (M I/O read cycle)
+	FastPin<PIN_BUSREQ>::low();        // Request DMA
+	FastPin<PIN_WAIT_RES>::low();      // Now safe reset WAIT FF (exit wait state)
+	holdIoCycle();                     // Wait to be sure Z80 read the data and go Hi-Z
+	DDRA = 0x00;                       // Configure Z80 data bus as input with pullup
+	PORTA = 0xFF;
+	FastPin<PIN_WAIT_RES>::high();     // Now Z80 is in DMA (Hi-Z), so safe to set WAIT_RES HIGH again
+	FastPin<PIN_BUSREQ>::high();       // Resume Z80 from DMA.
+}
+
+/**
+ * @brief Services an interrupt acknowledge (the Z80 is in WAIT).
+ */
+void serviceIoInterrupt() {
+	FastPin<PIN_INT>::high();
+
+	// VIRTUAL INTERRUPT
+	if (debug == DebugMode::TRACE) {
+		Uart.println();
+		Uart.println(F("DEBUG: INT op (nothing to do)"));
+	}
+
+	exitWaitState();
+}
+
+/**
+ * @brief Asserts /INT (Serial RX IRQ, irqStatus bit 0) when RX data is
+ * waiting and the Z80 enabled it (OP_IO_WR_SETIRQ). A burst raises a single
+ * interrupt: the IRQ is raised once the RX line has been idle for
+ * RX_IRQ_COALESCE_US (or the buffer fills up), and never again while it is
+ * still pending. Reading the RX port or SYSIRQ acknowledges it; if data is
+ * left, the next one follows.
+ */
+void serviceRxInterrupt() {
+	static byte lastCount = 0;
+	static unsigned long lastRxTime = 0;
+	if (!z80IntEnFlag || (irqStatus & B00000001)) {
+		return;
+	}
+
+	byte count = Uart.available();
+	if (!count) {
+		lastCount = 0;
+		return;
+	}
+
+	if (count != lastCount) {
+		lastCount = count;
+		lastRxTime = micros();
+	}
+
+	if ((count >= RX_IRQ_THRESHOLD) || ((micros() - lastRxTime) >= RX_IRQ_COALESCE_US)) {
+		FastPin<PIN_INT>::low();
+		irqStatus |= B00000001;
+	}
+}
+
+/**
+ * @brief Samples the watched GPIO inputs (OP_IO_WR_GPIOWATCH) and asserts
+ * /INT (GPIO IRQ, irqStatus bit 2) when one of them changed and the Z80
+ * enabled it (OP_IO_WR_SETIRQ).
+ */
+void serviceGpioInterrupt() {
+	if (BusControl.sampleInputs() && z80IntGpio) {
+		FastPin<PIN_INT>::low();
+		irqStatus |= B00000100;
+	}
+}
+
+/**
+ * @brief Polls the card slots (hot-plug) and asserts /INT (slot IRQ,
+ * irqStatus bit 3) when a card was inserted or removed and the Z80 enabled
+ * it (OP_IO_WR_SETIRQ). A change is handled one step per call: the parallel
+ * port is looked for again (its card may be the one that changed), then the
+ * slot OpCodes are updated and the IRQ raised.
+ */
+void serviceSlotInterrupt() {
+	switch (slotChangeStep) {
+		case 0:
+			if (BusControl.pollCards()) {
+				slotChangeStep = 1;
+			}
+			break;
+		case 1:
+			CyBorgSPP.detect();
+			slotChangeStep = 2;
+			break;
+		default:
+			updateSlotCards();
+			if (debug != DebugMode::OFF) {
+				Uart.print(F("DEBUG: Card slots changed: "));
+				Uart.println(BusControl.slotMask(), HEX);
+			}
 
-			// VIRTUAL INTERRUPT
-			if (debug == DebugMode::TRACE) {
-				Serial.println();
-				Serial.println(F("DEBUG: INT op (nothing to do)"));
+			if (z80IntSlots) {
+				FastPin<PIN_INT>::low();
+				irqStatus |= B00001000;
 			}
 
-			exitWaitState();
+			slotChangeStep = 0;
+			break;
+	}
+}
+
+/**
+ * @brief Confirms or reverts a BAUD rate switch made by OP_IO_WR_SETBAUD:
+ * the first byte received at the new rate confirms it (and stores it if
+ * requested); without one in BAUD_CONFIRM_MS the old rate is restored. The
+ * UART flags received bytes, so a byte the Z80 already read still counts.
+ */
+void serviceBaudSwitch() {
+	if (!baudSwitchPending) {
+		return;
+	}
+
+	if (Uart.isSwitching()) {
+		// Still sending the output queued before the switch: the
+		// confirmation time starts at the switch.
+		baudSwitchTime = millis();
+		return;
+	}
+
+	if (Uart.checkReceived()) {
+		baudSwitchPending = false;
+		if (baudSwitchSave) {
+			biosSettings_t.baudRate = currentBaudRate;
+			biosSettings_t.save();
 		}
 	}
+	else if ((millis() - baudSwitchTime) >= BAUD_CONFIRM_MS) {
+		baudSwitchPending = false;
+		switchBaudRate(previousBaudRate);
+	}
+}
+
+/**
+ * @brief Runs one background task per call, round robin, so the time spent
+ * away from the bus is bounded by the slowest task: looking for a card after
+ * a slot change (an address probe and three short register reads) or a
+ * single EEPROM byte write.
+ */
+void serviceBackground() {
+	static byte task = 0;
+	switch (task) {
+		case 0:
+			if (z80IntSysTick && ((micros() - timestamp) > (((unsigned long)sysTickTime) * 1000))) {
+				FastPin<PIN_INT>::low();
+				irqStatus |= B00000010;
+				timestamp = micros();
+			}
+			break;
+		case 1:
+			#ifdef BOOT_PROFILER
+			BootProfiler.service();
+			#endif
+			break;
+		case 2:
+			Uart.service();
+			break;
+		case 3:
+			serviceRxInterrupt();
+			break;
+		case 4:
+			serviceBaudSwitch();
+			break;
+		case 5:
+			CyBorgSPP.service();
+			break;
+		case 6:
+			serviceGpioInterrupt();
+			break;
+		case 7:
+			serviceSlotInterrupt();
+			break;
+		case 8:
+			TwiBus.service();
+			break;
+		default:
+			break;
+	}
 
-	if (z80IntSysTick) {
-		if ((micros() - timestamp) > (((unsigned long)sysTickTime) * 1000)) {
-			digitalWrite(PIN_INT, LOW);
-			irqStatus |= B00000010;
-			timestamp = micros();
+	task = (task + 1) % 9;
+}
+
+// WR, RD and AD0 are decoded from a single PINC read.
+static_assert((PIN_WR >= 16) && (PIN_WR < 24) && (PIN_RD >= 16) && (PIN_RD < 24)
+	&& (PIN_AD0 >= 16) && (PIN_AD0 < 24), "WR, RD and AD0 must be on PORTC");
+
+void loop() {
+	// The I/O service loop never returns to the core's main(), which would
+	// run serialEventRun() on every pass. Request to handler is about 8
+	// cycles (0.5us at 16MHz): in PINB, sbrc, in PINC, sbrs/sbrc, rjmp. With
+	// three digitalRead() calls it was 150+ cycles.
+	while (true) {
+		if (PINB & FastPin<PIN_WAIT>::mask()) {
+			// No I/O request pending.
+			serviceBackground();
+			continue;
+		}
+
+		byte ctrl = PINC;
+		if (!(ctrl & FastPin<PIN_WR>::mask())) {
+			serviceIoWrite((ctrl & FastPin<PIN_AD0>::mask()) ? 1 : 0);
+		}
+		else if (!(ctrl & FastPin<PIN_RD>::mask())) {
+			serviceIoRead((ctrl & FastPin<PIN_AD0>::mask()) ? 1 : 0);
+		}
+		else {
+			serviceIoInterrupt();
 		}
 	}
-}
\ No newline at end of file
+}
@@ -1,5 +1,6 @@
-#include <Wire.h>
 #include "hal.h"
+#include "TwiBus.h"
+#include "Uart.h"
 #include "iLoad.h"
 #include "rtc.h"
 
@@ -16,48 +17,44 @@ RtcClass::RtcClass() {
 }
 
 void RtcClass::update() {
-	// Set the seconds register.
-	Wire.beginTransmission(DS1307_RTC);
-	Wire.write(DS1307_SECRG);
-	Wire.endTransmission();
-
-	// Read from RTC and convert to binary.
-	Wire.requestFrom(DS1307_RTC, 18);
-	dateTime->seconds = bcdToDec(Wire.read() & 0x7f);
-	dateTime->minutes = bcdToDec(Wire.read());
-	dateTime->hours = bcdToDec(Wire.read() & 0x3f);
-	Wire.read(); // Skip over DoW.
-	dateTime->day = bcdToDec(Wire.read());
-	dateTime->month = bcdToDec(Wire.read());
-	dateTime->year = bcdToDec(Wire.read());
-	
-	// Skip over the next 10 registers.
-	for (uint8_t i = 0; i < 10; i++) {
-		Wire.read();
+	// Read from the seconds register up to the temperature and convert to binary.
+	byte regs[18];
+	if (TwiBus.readRegs(DS1307_RTC, DS1307_SECRG, regs, sizeof(regs)) != TWI_OK) {
+		return;
 	}
 
-	// Get tempurature.
-	dateTime->tempC = Wire.read();
+	dateTime->seconds = bcdToDec(regs[0] & 0x7f);
+	dateTime->minutes = bcdToDec(regs[1]);
+	dateTime->hours = bcdToDec(regs[2] & 0x3f);
+	// regs[3] is DoW (skipped).
+	dateTime->day = bcdToDec(regs[4]);
+	dateTime->month = bcdToDec(regs[5]);
+	dateTime->year = bcdToDec(regs[6]);
+
+	// Skip over the next 10 registers to get the temperature.
+	dateTime->tempC = regs[17];
 }
 
 void RtcClass::save() {
-	Wire.beginTransmission(DS1307_RTC);
-	Wire.write(DS1307_SECRG);
-	Wire.write(decToBcd(dateTime->seconds));
-	Wire.write(decToBcd(dateTime->minutes));
-	Wire.write(decToBcd(dateTime->hours));
-	Wire.write(1);  // DoW not used (always set to 1 = Sunday)
-	Wire.write(decToBcd(dateTime->day));
-	Wire.write(decToBcd(dateTime->month));
-	Wire.write(decToBcd(dateTime->year));
-	Wire.endTransmission();
+	byte data[8] = {
+		DS1307_SECRG,
+		decToBcd(dateTime->seconds),
+		decToBcd(dateTime->minutes),
+		decToBcd(dateTime->hours),
+		1,  // DoW not used (always set to 1 = Sunday)
+		decToBcd(dateTime->day),
+		decToBcd(dateTime->month),
+		decToBcd(dateTime->year)
+	};
+
+	TwiBus.write(DS1307_RTC, data, sizeof(data));
 }
 
 void RtcClass::print2Digit(byte data) {
 	if (data < 10) {
-		Serial.print(F("0"));
+		Uart.print(F("0"));
 	}
-	Serial.print(data);
+	Uart.print(data);
 }
 
 bool RtcClass::isLeapYear(byte year) {
@@ -70,40 +67,41 @@ void RtcClass::printDateTime(bool readDone) {
 	}
 
 	print2Digit(dateTime->year);
-	Serial.print(F("/"));
+	Uart.print(F("/"));
 	print2Digit(dateTime->month);
-	Serial.print(F("/"));
+	Uart.print(F("/"));
 	print2Digit(dateTime->day);
-	Serial.print(F(" "));
+	Uart.print(F(" "));
 	print2Digit(dateTime->hours);
-	Serial.print(F(":"));
+	Uart.print(F(":"));
 	print2Digit(dateTime->minutes);
-	Serial.print(F(":"));
+	Uart.print(F(":"));
 	print2Digit(dateTime->seconds);
 }
 
+bool RtcClass::isPresent() {
+	return TwiBus.probe(DS1307_RTC);
+}
+
 bool RtcClass::autoSet() {
-	Wire.beginTransmission(DS1307_RTC);
-	if (Wire.endTransmission() != 0) {
+	if (!TwiBus.probe(DS1307_RTC)) {
 		return false;
 	}
 
 	#ifdef DEBUG
-	Serial.print(F("INIT: boot3 - IOS: Found RTC DS1307 module ("));
+	Uart.print(F("INIT: boot3 - IOS: Found RTC DS1307 module ("));
 	printDateTime(true);
-	Serial.println(F(")"));
+	Uart.println(F(")"));
 
-	Serial.print(F("INIT: boot3 - IOS: RTC DS1307 temperature: "));
-	Serial.print((int8_t)dateTime->tempC);
-	Serial.println(F("C"));
+	Uart.print(F("INIT: boot3 - IOS: RTC DS1307 temperature: "));
+	Uart.print((int8_t)dateTime->tempC);
+	Uart.println(F("C"));
 	#endif
 
 	// Read oscillator stop flag.
-	Wire.beginTransmission(DS1307_RTC);
-	Wire.write(DS1307_STATRG);
-	Wire.endTransmission();
-	Wire.requestFrom(DS1307_RTC, 1);
-	byte ocsStopFlag = Wire.read() & 0x80;
+	byte ocsStopFlag = 0;
+	TwiBus.readRegs(DS1307_RTC, DS1307_STATRG, &ocsStopFlag, 1);
+	ocsStopFlag &= 0x80;
 
 	// RTC oscillator stopped. RTC must be set to compile date/time.
 	if (ocsStopFlag) {
@@ -143,32 +141,29 @@ bool RtcClass::autoSet() {
 		dateTime->year = compDateStr.substring(9, 11).toInt();
 
 		// Ask to set RTC to compile time on failure.
-		Serial.println(F("IOS: RTC failure!"));
-		Serial.print(F("\nDo you want to set RTC to IOS compile time ("));
+		Uart.println(F("IOS: RTC failure!"));
+		Uart.print(F("\nDo you want to set RTC to IOS compile time ("));
 		printDateTime(false);
-		Serial.print(F(")? [Y/N] >"));
+		Uart.print(F(")? [Y/N] >"));
 		
 		char inChar;
 		unsigned long timestamp = millis();
 		do {
 			blinkIOSled(&timestamp);
-			inChar = Serial.read();
+			inChar = Uart.read();
 		} while((inChar != 'y') && (inChar != 'Y') && (inChar != 'n') && (inChar != 'N'));
-		Serial.println(inChar);
+		Uart.println(inChar);
 
 		// If yes, set the RTC to the compile date/time and print message.
 		if ((inChar == 'y') || (inChar == 'Y')) {
 			save();
-			Serial.print(F("IOS: RTC set to compile time - Now: "));
+			Uart.print(F("IOS: RTC set to compile time - Now: "));
 			printDateTime(true);
-			Serial.println();
+			Uart.println();
 		}
 
 		// Reset oscillator stop flag.
-		Wire.beginTransmission(DS1307_RTC);
-		Wire.write(DS1307_STATRG);
-		Wire.write(DS1307_OSC);
-		Wire.endTransmission();
+		TwiBus.post(DS1307_RTC, DS1307_STATRG, DS1307_OSC);
 	}
 
 	return true;
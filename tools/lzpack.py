@@ -0,0 +1,124 @@
+#!/usr/bin/env python3
+"""
+Compress a Z80 boot image into a resident flash payload for the CyBorg BIOS.
+
+The output is a C header with the LZ compressed image in PROGMEM, its size and
+its CRC-16/XMODEM, ready to be referenced from flashBootTable (see
+include/iLoad.h). Format (LZSS, 64 byte
+window, decoded by FlashPayloadClass::inject()):
+
+  A flag byte precedes every group of 8 items, LSB first.
+  Flag bit 1: a literal byte follows.
+  Flag bit 0: a match follows as 2 bytes: (distance - 1) and (length - 3),
+              copying 3..258 bytes from 1..64 bytes back in the output.
+              The window matches LZ_WINDOW_SIZE (include/FlashPayload.h):
+              the decoder keeps it on the stack of a 2KB RAM part.
+
+Usage:
+  tools/lzpack.py BASIC47.BIN payloadBasic > include/payloadBasic.h
+"""
+
+import sys
+
+WINDOW = 64
+MIN_MATCH = 3
+MAX_MATCH = 258
+
+
+def compress(data):
+    out = bytearray()
+    items = []
+    pos = 0
+    while pos < len(data):
+        best_len = 0
+        best_dist = 0
+        for dist in range(1, min(WINDOW, pos) + 1):
+            length = 0
+            while (length < MAX_MATCH and pos + length < len(data)
+                   and data[pos + length - dist] == data[pos + length]):
+                length += 1
+            if length > best_len:
+                best_len = length
+                best_dist = dist
+        if best_len >= MIN_MATCH:
+            items.append((False, bytes([best_dist - 1, best_len - MIN_MATCH])))
+            pos += best_len
+        else:
+            items.append((True, bytes([data[pos]])))
+            pos += 1
+
+    for group in range(0, len(items), 8):
+        chunk = items[group:group + 8]
+        flags = 0
+        for bit, (literal, _) in enumerate(chunk):
+            if literal:
+                flags |= 1 << bit
+        out.append(flags)
+        for _, payload in chunk:
+            out += payload
+    return bytes(out)
+
+
+def decompress(packed, size):
+    out = bytearray()
+    src = 0
+    flags = 0
+    bits = 0
+    while len(out) < size:
+        if not bits:
+            flags = packed[src]
+            src += 1
+            bits = 8
+        if flags & 1:
+            out.append(packed[src])
+            src += 1
+        else:
+            dist = packed[src] + 1
+            length = packed[src + 1] + MIN_MATCH
+            src += 2
+            for _ in range(length):
+                if len(out) == size:
+                    break
+                out.append(out[-dist])
+        flags >>= 1
+        bits -= 1
+    return bytes(out)
+
+
+def crc16_xmodem(data):
+    # Same as avr-libc _crc_xmodem_update(), used by the BIOS to compare the
+    # SD boot image with the resident one.
+    crc = 0
+    for b in data:
+        crc ^= b << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else (crc << 1)
+            crc &= 0xFFFF
+    return crc
+
+
+def main():
+    if len(sys.argv) != 3:
+        sys.stderr.write(__doc__)
+        return 1
+
+    with open(sys.argv[1], 'rb') as f:
+        data = f.read()
+    name = sys.argv[2]
+    packed = compress(data)
+    if decompress(packed, len(data)) != data:
+        sys.stderr.write('lzpack: round trip check failed\n')
+        return 1
+
+    print('const word %sSize = %d;  // Uncompressed image size' % (name, len(data)))
+    print('const word %sCrc = 0x%04X;  // Uncompressed image CRC-16/XMODEM' % (name, crc16_xmodem(data)))
+    print('const byte %s[] PROGMEM = {  // %d bytes LZ compressed' % (name, len(packed)))
+    for i in range(0, len(packed), 16):
+        row = ', '.join('0x%02X' % b for b in packed[i:i + 16])
+        print('  %s%s' % (row, ',' if i + 16 < len(packed) else ''))
+    print('  };')
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())